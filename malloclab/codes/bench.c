@@ -0,0 +1,456 @@
+/*
+ * bench.c - Replay allocation traces against every malloc package.
+ *
+ * All the packages are linked into this one binary: the Makefile compiles
+ * each mm-<name>.c with its public symbols renamed to <name>_mm_*, and they
+ * take turns on the simulated heap of memlib.c.
+ *
+ * A trace uses the format of the CS:APP driver:
+ *
+ *     <suggested heap size>    (ignored)
+ *     <number of ids>
+ *     <number of operations>
+ *     <weight>                 (ignored)
+ *     a <id> <bytes>           allocate
+ *     r <id> <bytes>           reallocate
+ *     f <id>                   free
+ *
+ * Each trace is replayed twice per package.  The first pass checks the
+ * results: every block must be aligned and inside the heap (or anywhere,
+ * with -m, for packages that map large blocks on their own; the utilization
+ * then only counts the heap and can pass 100%), a payload must
+ * keep its contents until it is freed (realloc keeps the common prefix),
+ * and mm_checkheap must stay silent, both every -c operations and at the
+ * end.  The peak utilization is the largest total payload that was live at
+ * once divided by the final size of the heap.  The second pass only times
+ * the calls, replaying the trace until at least MIN_SECS have passed, and
+ * gives the throughput.
+ *
+ * The exit status is 1 if any package failed a check, else 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "memlib.h"
+
+#define ALIGNMENT 8
+#define MIN_SECS  0.05   /* time each trace at least this long */
+#define MAX_REPS  1000   /* but never replay it more often than this */
+
+/* every package has the same interface */
+#define VARIANTS(X) \
+    X(naive) X(textbook) X(explicit) X(segregated) X(tlsf) X(mm)
+
+#define DECLARE(name)                                      \
+    int name##_mm_init(void);                              \
+    void *name##_mm_malloc(size_t size);                   \
+    void name##_mm_free(void *ptr);                        \
+    void *name##_mm_realloc(void *ptr, size_t size);       \
+    void name##_mm_checkheap(int lineno);
+VARIANTS(DECLARE)
+
+typedef struct {
+    const char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*checkheap)(int lineno);
+} variant_t;
+
+#define ENTRY(name)                                        \
+    { #name, name##_mm_init, name##_mm_malloc, name##_mm_free, \
+      name##_mm_realloc, name##_mm_checkheap },
+static const variant_t variants[] = { VARIANTS(ENTRY) };
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+typedef struct {
+    char type;       /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+} op_t;
+
+typedef struct {
+    const char *path;
+    int num_ids;
+    int num_ops;
+    op_t *ops;
+} trace_t;
+
+typedef struct {
+    int ok;
+    double util;     /* peak payload / heap size */
+    double ops_sec;
+} result_t;
+
+static int check_every = 1000;  /* -c: operations between mm_checkheap calls */
+static int verbose = 0;         /* -v: print every check that fails */
+static int mapped_ok = 0;       /* -m: blocks may lie outside the simulated heap */
+
+/*
+ * read_trace - Parse the trace at path; exit on malformed input
+ */
+static void read_trace(const char *path, trace_t *t) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        exit(2);
+    }
+
+    int heap, weight;
+    if (fscanf(fp, "%d %d %d %d", &heap, &t->num_ids, &t->num_ops, &weight) != 4
+        || t->num_ids < 0 || t->num_ops < 0) {
+        fprintf(stderr, "%s: bad header\n", path);
+        exit(2);
+    }
+    t->path = path;
+    t->ops = calloc(t->num_ops ? t->num_ops : 1, sizeof(op_t));
+
+    for (int i = 0; i < t->num_ops; ++i) {
+        op_t *op = &t->ops[i];
+        char type[2];
+        unsigned long size = 0;
+        int n;
+        if (fscanf(fp, "%1s %d", type, &op->id) != 2)
+            n = 0;
+        else if (type[0] == 'f')
+            n = 3;
+        else
+            n = 2 + fscanf(fp, "%lu", &size);
+        op->type = type[0];
+        op->size = size;
+        if (n != 3 || (op->type != 'a' && op->type != 'r' && op->type != 'f')
+            || op->id < 0 || op->id >= t->num_ids) {
+            fprintf(stderr, "%s: bad operation %d\n", path, i);
+            exit(2);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * checkheap - Run the package's mm_checkheap with stdout captured;
+ *      return 0 if it printed nothing, else copy its output to stderr
+ *      and return -1
+ */
+static int checkheap(const variant_t *v, int lineno) {
+    FILE *tmp = tmpfile();
+    if (tmp == NULL) {
+        perror("tmpfile");
+        exit(2);
+    }
+
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(tmp), STDOUT_FILENO);
+    v->checkheap(lineno);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    long len = lseek(fileno(tmp), 0, SEEK_END);
+    if (len > 0) {
+        char buf[256];
+        size_t n;
+        rewind(tmp);
+        while ((n = fread(buf, 1, sizeof(buf), tmp)) > 0)
+            fwrite(buf, 1, n, stderr);
+    }
+    fclose(tmp);
+    return len > 0 ? -1 : 0;
+}
+
+/* the byte stored at offset i of the payload of id */
+#define PATTERN(id, i) ((unsigned char)((id) * 131 + (i) * 7 + 1))
+
+static void fill(unsigned char *p, int id, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        p[i] = PATTERN(id, i);
+}
+
+static int intact(const unsigned char *p, int id, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        if (p[i] != PATTERN(id, i))
+            return 0;
+    return 1;
+}
+
+#define FAIL(...) do {                                             \
+        if (verbose || failures == 0) {                            \
+            fprintf(stderr, "%s [%s] op %d: ", t->path, v->name, i); \
+            fprintf(stderr, __VA_ARGS__);                          \
+            fputc('\n', stderr);                                   \
+        }                                                          \
+        ++failures;                                                \
+    } while (0)
+
+/*
+ * check_block - Return 0 if [p, p+size) is an aligned block inside the heap,
+ *      or anywhere with -m
+ */
+static int check_block(const void *p, size_t size) {
+    const char *lo = mem_heap_lo(), *hi = mem_heap_hi();
+    if ((uintptr_t)p % ALIGNMENT != 0)
+        return -1;
+    if (mapped_ok)
+        return 0;
+    if ((const char *)p < lo || (size && (const char *)p + size - 1 > hi))
+        return -1;
+    return 0;
+}
+
+/*
+ * check_trace - Replay t on v checking every result; fill in the
+ *      utilization and return the number of failed checks
+ */
+static int check_trace(const variant_t *v, const trace_t *t, double *util) {
+    void **ptrs = calloc(t->num_ids ? t->num_ids : 1, sizeof(void *));
+    size_t *sizes = calloc(t->num_ids ? t->num_ids : 1, sizeof(size_t));
+    size_t live = 0, peak = 0;
+    int failures = 0;
+    int i = 0;
+
+    mem_reset_brk();
+    if (v->init() < 0) {
+        FAIL("mm_init failed");
+        goto out;
+    }
+
+    for (i = 0; i < t->num_ops; ++i) {
+        const op_t *op = &t->ops[i];
+        int id = op->id;
+        unsigned char *p;
+
+        switch (op->type) {
+        case 'a':
+            p = v->malloc(op->size);
+            if (p == NULL) {
+                FAIL("malloc(%zu) returned NULL", op->size);
+                goto out;
+            }
+            if (check_block(p, op->size) < 0)
+                FAIL("malloc(%zu) returned bad block %p", op->size, (void *)p);
+            fill(p, id, op->size);
+            ptrs[id] = p;
+            sizes[id] = op->size;
+            live += op->size;
+            break;
+
+        case 'r':
+            if (ptrs[id] && !intact(ptrs[id], id, sizes[id]))
+                FAIL("payload of id %d overwritten before realloc", id);
+            p = v->realloc(ptrs[id], op->size);
+            if (p == NULL && op->size != 0) {
+                FAIL("realloc(%zu) returned NULL", op->size);
+                goto out;
+            }
+            if (p != NULL) {
+                size_t keep = sizes[id] < op->size ? sizes[id] : op->size;
+                if (check_block(p, op->size) < 0)
+                    FAIL("realloc(%zu) returned bad block %p", op->size, (void *)p);
+                else if (!intact(p, id, keep))
+                    FAIL("realloc did not preserve the payload of id %d", id);
+                fill(p, id, op->size);
+            }
+            ptrs[id] = p;
+            live += op->size;
+            live -= sizes[id];
+            sizes[id] = op->size;
+            break;
+
+        case 'f':
+            if (ptrs[id] && !intact(ptrs[id], id, sizes[id]))
+                FAIL("payload of id %d overwritten before free", id);
+            v->free(ptrs[id]);
+            live -= sizes[id];
+            ptrs[id] = NULL;
+            sizes[id] = 0;
+            break;
+        }
+        if (live > peak)
+            peak = live;
+
+        if (check_every > 0 && (i + 1) % check_every == 0
+            && checkheap(v, i) < 0)
+            FAIL("mm_checkheap reported errors");
+    }
+
+    if (checkheap(v, i) < 0)
+        FAIL("mm_checkheap reported errors");
+
+out:
+    *util = mem_heapsize() ? (double)peak / mem_heapsize() : 0;
+    free(ptrs);
+    free(sizes);
+    return failures;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * time_trace - Return the operations per second of v on t
+ */
+static double time_trace(const variant_t *v, const trace_t *t) {
+    void **ptrs = malloc((t->num_ids ? t->num_ids : 1) * sizeof(void *));
+    double elapsed = 0;
+    long ops = 0;
+
+    for (int rep = 0; rep < MAX_REPS && elapsed < MIN_SECS; ++rep) {
+        memset(ptrs, 0, (t->num_ids ? t->num_ids : 1) * sizeof(void *));
+        mem_reset_brk();
+        v->init();
+
+        double start = now();
+        for (int i = 0; i < t->num_ops; ++i) {
+            const op_t *op = &t->ops[i];
+            switch (op->type) {
+            case 'a': ptrs[op->id] = v->malloc(op->size); break;
+            case 'r': ptrs[op->id] = v->realloc(ptrs[op->id], op->size); break;
+            case 'f': v->free(ptrs[op->id]); ptrs[op->id] = NULL; break;
+            }
+        }
+        elapsed += now() - start;
+        ops += t->num_ops;
+    }
+    free(ptrs);
+    return elapsed > 0 ? ops / elapsed : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-c N] [-m] [-n name] [-v] trace...\n"
+            "  -c N     call mm_checkheap every N operations (0: only at the end)\n"
+            "  -m       allow blocks outside the simulated heap (mm.c with MM_MMAP_THRESHOLD)\n"
+            "  -n name  only run the named package (may be repeated)\n"
+            "  -v       report every failed check, not just the first\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int selected[NVARIANTS] = {0};
+    int any_selected = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "c:mn:v")) != -1) {
+        switch (c) {
+        case 'c':
+            check_every = atoi(optarg);
+            break;
+        case 'n': {
+            size_t k;
+            for (k = 0; k < NVARIANTS; ++k)
+                if (strcmp(optarg, variants[k].name) == 0)
+                    break;
+            if (k == NVARIANTS) {
+                fprintf(stderr, "unknown package %s\n", optarg);
+                usage(argv[0]);
+            }
+            selected[k] = any_selected = 1;
+            break;
+        }
+        case 'm':
+            mapped_ok = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc)
+        usage(argv[0]);
+    if (!any_selected)
+        for (size_t k = 0; k < NVARIANTS; ++k)
+            selected[k] = 1;
+
+    int ntraces = argc - optind;
+    trace_t *traces = calloc(ntraces, sizeof(trace_t));
+    for (int j = 0; j < ntraces; ++j)
+        read_trace(argv[optind + j], &traces[j]);
+
+    result_t (*res)[NVARIANTS] = calloc(ntraces, sizeof(*res));
+    int failed = 0;
+
+    mem_init();
+    for (int j = 0; j < ntraces; ++j) {
+        for (size_t k = 0; k < NVARIANTS; ++k) {
+            if (!selected[k])
+                continue;
+            result_t *r = &res[j][k];
+            r->ok = check_trace(&variants[k], &traces[j], &r->util) == 0;
+            if (r->ok)
+                r->ops_sec = time_trace(&variants[k], &traces[j]);
+            else
+                failed = 1;
+        }
+    }
+    mem_deinit();
+
+    /* one row per trace, util% and Kops/s side by side for each package */
+    printf("%-24s", "trace");
+    for (size_t k = 0; k < NVARIANTS; ++k)
+        if (selected[k])
+            printf(" %19s", variants[k].name);
+    printf("\n%-24s", "");
+    for (size_t k = 0; k < NVARIANTS; ++k)
+        if (selected[k])
+            printf(" %7s %11s", "util%", "Kops/s");
+    printf("\n");
+
+    for (int j = 0; j < ntraces; ++j) {
+        const char *base = strrchr(traces[j].path, '/');
+        printf("%-24.24s", base ? base + 1 : traces[j].path);
+        for (size_t k = 0; k < NVARIANTS; ++k) {
+            if (!selected[k])
+                continue;
+            if (res[j][k].ok)
+                printf(" %7.1f %11.0f", 100 * res[j][k].util,
+                       res[j][k].ops_sec / 1000);
+            else
+                printf(" %19s", "FAIL");
+        }
+        printf("\n");
+    }
+
+    /* mean utilization and total throughput over the traces that passed */
+    printf("%-24s", "total");
+    for (size_t k = 0; k < NVARIANTS; ++k) {
+        if (!selected[k])
+            continue;
+        double util = 0, secs = 0;
+        long ops = 0;
+        int ok = 1;
+        for (int j = 0; j < ntraces; ++j) {
+            if (!res[j][k].ok) {
+                ok = 0;
+                continue;
+            }
+            util += res[j][k].util;
+            ops += traces[j].num_ops;
+            secs += res[j][k].ops_sec > 0 ? traces[j].num_ops / res[j][k].ops_sec : 0;
+        }
+        if (ok)
+            printf(" %7.1f %11.0f", 100 * util / ntraces,
+                   secs > 0 ? ops / secs / 1000 : 0);
+        else
+            printf(" %19s", "FAIL");
+    }
+    printf("\n");
+
+    for (int j = 0; j < ntraces; ++j)
+        free(traces[j].ops);
+    free(traces);
+    free(res);
+    return failed;
+}
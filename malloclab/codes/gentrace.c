@@ -0,0 +1,341 @@
+/*
+ * gentrace.c - Generate synthetic allocation traces for bench.
+ *
+ * The traces are written in the .rep format that bench reads.  Every
+ * workload is driven by a seeded xorshift generator, so the same arguments
+ * always give the same trace, on any machine.  All blocks still live at the
+ * end of the trace are freed.
+ *
+ * Workloads (-w):
+ *   powerlaw  sizes from a Pareto distribution (-a alpha), random lifetimes,
+ *             about -l blocks live at a time
+ *   prodcons  messages freed in the order they were allocated once the queue
+ *             is about -l deep, plus a few long-lived blocks
+ *   realloc   buffers grown by realloc chains among small short-lived blocks
+ *   phases    bursts of allocation around one size followed by draining the
+ *             heap; every phase picks a new size and length
+ *   near512   the 439..451 and 448..520 byte requests the final version
+ *             special-cases, paired with small blocks as in the course traces
+ *   mix       each operation comes from one of the workloads above
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+
+typedef struct {
+    char type;
+    int id;
+    size_t size;
+} op_t;
+
+/* a set of live ids; ids are removed by swapping in the last one */
+typedef struct {
+    int *ids;
+    int n, cap;
+} pool_t;
+
+/* a FIFO of live ids */
+typedef struct {
+    int *ids;
+    int head, tail, cap;   /* ids[head..tail) are queued, modulo cap */
+} queue_t;
+
+#define CHAINS 8           /* realloc chains grown at the same time */
+
+typedef struct {
+    int id;                /* -1: not started */
+    size_t size, limit;
+} chain_t;
+
+/* generator state shared by all the workloads */
+static struct {
+    uint64_t rng;
+    op_t *ops;
+    int nops, cap;
+    int next_id;
+
+    int live;              /* -l */
+    double alpha;          /* -a */
+    size_t max_size;       /* -m */
+
+    pool_t pool;           /* powerlaw, phases, near512, and small noise */
+    queue_t queue;         /* prodcons */
+    pool_t keep;           /* long-lived blocks of prodcons */
+    chain_t chains[CHAINS];
+
+    int phase_left;        /* ops left in the current phase */
+    int phase_drain;       /* 1: the phase frees, 0: it allocates */
+    size_t phase_size;
+} g;
+
+static uint64_t rnd(void) {
+    g.rng ^= g.rng << 13;
+    g.rng ^= g.rng >> 7;
+    g.rng ^= g.rng << 17;
+    return g.rng;
+}
+
+/* uniform in [0, 1) */
+static double unit(void) {
+    return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* uniform in [lo, hi] */
+static size_t range(size_t lo, size_t hi) {
+    return lo + rnd() % (hi - lo + 1);
+}
+
+/* Pareto distributed size in [lo, hi] */
+static size_t pareto(size_t lo, size_t hi) {
+    double s = lo / pow(1.0 - unit(), 1.0 / g.alpha);
+    return s > hi ? hi : (size_t)s;
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    if (p == NULL) {
+        perror("realloc");
+        exit(2);
+    }
+    return p;
+}
+
+static void emit(char type, int id, size_t size) {
+    if (g.nops == g.cap) {
+        g.cap = g.cap ? 2 * g.cap : 4096;
+        g.ops = xrealloc(g.ops, g.cap * sizeof(op_t));
+    }
+    g.ops[g.nops].type = type;
+    g.ops[g.nops].id = id;
+    g.ops[g.nops].size = size;
+    ++g.nops;
+}
+
+static int emit_alloc(size_t size) {
+    int id = g.next_id++;
+    emit('a', id, size ? size : 1);
+    return id;
+}
+
+static void pool_add(pool_t *p, int id) {
+    if (p->n == p->cap) {
+        p->cap = p->cap ? 2 * p->cap : 256;
+        p->ids = xrealloc(p->ids, p->cap * sizeof(int));
+    }
+    p->ids[p->n++] = id;
+}
+
+/* free a random member of p */
+static void pool_free(pool_t *p) {
+    int i = rnd() % p->n;
+    emit('f', p->ids[i], 0);
+    p->ids[i] = p->ids[--p->n];
+}
+
+static int queue_len(const queue_t *q) {
+    return q->tail - q->head;
+}
+
+static void queue_push(queue_t *q, int id) {
+    if (queue_len(q) == q->cap) {
+        int *ids = xrealloc(NULL, (q->cap ? 2 * q->cap : 256) * sizeof(int));
+        for (int i = q->head; i < q->tail; ++i)
+            ids[i - q->head] = q->ids[i % q->cap];
+        free(q->ids);
+        q->ids = ids;
+        q->tail -= q->head;
+        q->head = 0;
+        q->cap = q->cap ? 2 * q->cap : 256;
+    }
+    q->ids[q->tail++ % q->cap] = id;
+}
+
+static int queue_pop(queue_t *q) {
+    return q->ids[q->head++ % q->cap];
+}
+
+/*
+ * churn - Allocate or free one block of the pool, allocating more often
+ *      while fewer than target blocks are live
+ */
+static void churn(pool_t *p, int target, size_t size) {
+    double fill = (double)p->n / (target > 0 ? target : 1);
+    if (p->n == 0 || unit() < 0.9 - 0.4 * (fill > 1 ? 1 : fill))
+        pool_add(p, emit_alloc(size));
+    else
+        pool_free(p);
+}
+
+static void step_powerlaw(void) {
+    churn(&g.pool, g.live, pareto(8, g.max_size));
+}
+
+static void step_prodcons(void) {
+    double fill = (double)queue_len(&g.queue) / g.live;
+    if (unit() < 0.02)
+        pool_add(&g.keep, emit_alloc(pareto(16, g.max_size)));
+    else if (queue_len(&g.queue) == 0 || unit() < 0.9 - 0.4 * (fill > 1 ? 1 : fill))
+        queue_push(&g.queue, emit_alloc(pareto(32, 4096)));
+    else
+        emit('f', queue_pop(&g.queue), 0);
+}
+
+static void step_realloc(void) {
+    if (unit() < 0.3) {
+        churn(&g.pool, g.live / 4, range(8, 128));
+        return;
+    }
+
+    chain_t *c = &g.chains[rnd() % CHAINS];
+    if (c->id < 0) {
+        c->size = range(16, 256);
+        c->limit = pareto(1024, 4 * g.max_size);
+        c->id = emit_alloc(c->size);
+    } else if (c->size >= c->limit) {
+        emit('f', c->id, 0);
+        c->id = -1;
+    } else {
+        /* grow by a factor from 1.1 to 2, or by a few bytes */
+        if (unit() < 0.5)
+            c->size = (size_t)(c->size * (1.1 + 0.9 * unit()));
+        else
+            c->size += range(1, 64);
+        emit('r', c->id, c->size);
+    }
+}
+
+static void step_phases(void) {
+    if (g.phase_left-- <= 0) {
+        g.phase_left = range(200, 2000);
+        g.phase_drain = !g.phase_drain && g.pool.n > 0;
+        g.phase_size = pareto(16, g.max_size);
+    }
+
+    if (g.phase_drain) {
+        /* keep about a tenth of the blocks across the phase change */
+        if (g.pool.n > g.live / 10)
+            pool_free(&g.pool);
+        else
+            g.phase_left = 0;
+    } else if (unit() < 0.85 || g.pool.n == 0) {
+        size_t s = g.phase_size;
+        pool_add(&g.pool, emit_alloc(range(s - s / 8, s + s / 8)));
+    } else {
+        pool_free(&g.pool);
+    }
+}
+
+static void step_near512(void) {
+    size_t size;
+    double u = unit();
+    if (u < 0.4)
+        size = range(439, 451);
+    else if (u < 0.6)
+        size = range(448, 520);
+    else
+        size = range(8, 72);
+    churn(&g.pool, g.live, size);
+}
+
+typedef struct {
+    const char *name;
+    void (*step)(void);
+} workload_t;
+
+static void step_mix(void);
+
+static const workload_t workloads[] = {
+    { "powerlaw", step_powerlaw },
+    { "prodcons", step_prodcons },
+    { "realloc",  step_realloc  },
+    { "phases",   step_phases   },
+    { "near512",  step_near512  },
+    { "mix",      step_mix      },
+};
+#define NWORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+static void step_mix(void) {
+    workloads[rnd() % (NWORKLOADS - 1)].step();
+}
+
+/*
+ * finish - Free every block that is still live
+ */
+static void finish(void) {
+    while (queue_len(&g.queue) > 0)
+        emit('f', queue_pop(&g.queue), 0);
+    for (int i = 0; i < g.keep.n; ++i)
+        emit('f', g.keep.ids[i], 0);
+    for (int i = 0; i < g.pool.n; ++i)
+        emit('f', g.pool.ids[i], 0);
+    for (int i = 0; i < CHAINS; ++i)
+        if (g.chains[i].id >= 0)
+            emit('f', g.chains[i].id, 0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-w workload] [-n ops] [-s seed] [-l live] [-a alpha] [-m max]\n"
+            "  -w workload  powerlaw, prodcons, realloc, phases, near512 or mix (default mix)\n"
+            "  -n ops       operations before the final frees (default 20000)\n"
+            "  -s seed      seed of the generator (default 1)\n"
+            "  -l live      blocks live at a time, roughly (default 1000)\n"
+            "  -a alpha     Pareto shape of the sizes, larger is lighter tailed (default 1.2)\n"
+            "  -m max       largest size drawn from the distribution (default 65536)\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const workload_t *w = &workloads[NWORKLOADS - 1];
+    long nops = 20000;
+    unsigned long seed = 1;
+    int c;
+
+    g.live = 1000;
+    g.alpha = 1.2;
+    g.max_size = 65536;
+
+    while ((c = getopt(argc, argv, "w:n:s:l:a:m:")) != -1) {
+        switch (c) {
+        case 'w':
+            for (w = workloads; w < workloads + NWORKLOADS; ++w)
+                if (strcmp(optarg, w->name) == 0)
+                    break;
+            if (w == workloads + NWORKLOADS) {
+                fprintf(stderr, "unknown workload %s\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'n': nops = atol(optarg); break;
+        case 's': seed = strtoul(optarg, NULL, 0); break;
+        case 'l': g.live = atoi(optarg); break;
+        case 'a': g.alpha = atof(optarg); break;
+        case 'm': g.max_size = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || nops < 0 || g.live <= 0 || g.alpha <= 0 || g.max_size < 1024)
+        usage(argv[0]);
+
+    /* xorshift must not start from 0; mix the seed so nearby seeds differ */
+    g.rng = (seed + 1) * 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < CHAINS; ++i)
+        g.chains[i].id = -1;
+
+    while (g.nops < nops)
+        w->step();
+    finish();
+
+    printf("%d\n%d\n%d\n%d\n", 20000, g.next_id, g.nops, 1);
+    for (int i = 0; i < g.nops; ++i) {
+        if (g.ops[i].type == 'f')
+            printf("f %d\n", g.ops[i].id);
+        else
+            printf("%c %d %zu\n", g.ops[i].type, g.ops[i].id, g.ops[i].size);
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
+ *            with the system's malloc package in libc.
+ *
+ * The simulated heap lives at the same fixed address as in the handout
+ * (0x800000000), so allocators that store 32-bit offsets from the start of
+ * the heap work unchanged.  The region is reserved with MAP_NORESERVE, so
+ * only the pages that are actually touched cost memory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+
+#define HEAP_BASE ((void *)MEM_HEAP_BASE)  /* address of the simulated heap */
+#define MAX_HEAP  (1UL << 32)              /* 4 GB, the range of a 32-bit offset */
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap plus one */
+static char *mem_max_addr;   /* largest legal heap address plus one */
+
+/*
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void)
+{
+    mem_start_brk = mmap(HEAP_BASE, MAX_HEAP, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+        fprintf(stderr, "mem_init: mmap failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (mem_start_brk != (char *)HEAP_BASE) {
+        fprintf(stderr, "mem_init: heap not mapped at %p\n", HEAP_BASE);
+        exit(1);
+    }
+
+    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_brk = mem_start_brk;                  /* heap is empty initially */
+}
+
+/*
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    munmap(mem_start_brk, MAX_HEAP);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_reset_brk(void)
+{
+    mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area. In
+ *    this model, the heap cannot be shrunk.
+ */
+void *mem_sbrk(int incr)
+{
+    char *old_brk = mem_brk;
+
+    if ((incr < 0) || ((size_t)(mem_max_addr - mem_brk) < (size_t)incr)) {
+        errno = ENOMEM;
+        fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+        return (void *)-1;
+    }
+    mem_brk += incr;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(void)
+{
+    return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(void)
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize(void)
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(void)
+{
+    return (size_t)getpagesize();
+}
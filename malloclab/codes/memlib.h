@@ -0,0 +1,16 @@
+/*
+ * memlib.h - Interface of the memory system model used by the drivers.
+ */
+#include <unistd.h>
+
+/* address of the simulated heap; mm.c stores 32-bit offsets from it */
+#define MEM_HEAP_BASE 0x800000000UL
+
+void mem_init(void);
+void mem_deinit(void);
+void *mem_sbrk(int incr);
+void mem_reset_brk(void);
+void *mem_heap_lo(void);
+void *mem_heap_hi(void);
+size_t mem_heapsize(void);
+size_t mem_pagesize(void);
@@ -608,4 +608,15 @@ void mm_checkheap(int lineno) {
     }
 }
 
-void print_list(){
\ No newline at end of file
+void print_list(){
+    if(list_head == NULL) {
+        printf("The list is empty\n");
+        return;
+    }
+    void * tmp = list_head;
+    int cnt = 0;
+    for(;tmp != NULL;tmp = SUCC(tmp),cnt++){
+        printf("Node %d: %lx\n",cnt,PTR_VALUE(tmp));
+    }
+    printf("Done\n");
+}
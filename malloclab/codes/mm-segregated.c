@@ -650,7 +650,7 @@ void mm_checkheap(int lineno) {
 
 
     /*check the free block list*/
-    for(int i = 0;i < 12;++i){
+    for(int i = 0;i < LISTNUM;++i){
         bp = GET_PTR(seg_list + i*WSIZE);
         void * pred = NULL;
         void * succ = NULL;
@@ -0,0 +1,694 @@
+/*
+ * mm-tlsf.c
+ *
+ * ID:1900011003@pku.edu.cn   Name:ZhangBaiZhou 张柏舟
+ *
+ * 使用两级分离适配（Two-Level Segregated Fit, TLSF）实现malloc/free/realloc，
+ * malloc和free的时间有常数上界，不随空闲块的个数增长。
+ *
+ * 用到的一些技巧：
+ * 1.与mm.c相同，指针在堆中以4字节的形式存在，已分配块没有footer，
+ *   header的倒数第二位记录前一个块是否被allocated。
+ *
+ * 2.空闲块按大小分为两级：第一级fl为大小的最高有效位，第二级sl把[2^fl,2^(fl+1))再等分为SL_NUM个区间，
+ *   每个(fl,sl)对应一个双向链表。小于SMALL_BLOCK的块按8字节线性划分，全部归入fl=0。
+ *   fl_map的第fl位表示第fl行是否有非空链表，sl_map[fl]的第sl位表示链表(fl,sl)是否非空。
+ *
+ * 3.malloc时先把请求的大小向上取整到所在区间的上界，则该区间及之后任一非空链表的第一个块都足够大，
+ *   借助两级位图和count-trailing-zeros指令即可在常数时间内找到，不需要遍历链表。
+ *   链表内的块不排序，插入和删除都在常数时间内完成。
+ *
+ * 4.堆的结构：（每个方块为4字节）
+ *
+ *    __________________________________________________________________________________
+ *    | fl_map | sl_map[0..FL_NUM) | 表头[0..FL_NUM*SL_NUM) | 填充 | 序言块 | 序言块 | ... | 结尾块 |
+ *    |________|___________________|_______________________|_____|__8/1__|__8/1__|_____|__0/1__|
+ *             ^                   ^                                       ^
+ *             |                   |                                       |
+ *           sl_map             seg_list                               heap_listp
+ *
+ *   已分配块与空闲块的结构与mm.c相同。
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* If you want debugging output, use the following macro.  When you hand
+ * in, remove the #define DEBUG line. */
+#define DEBUG
+#ifdef DEBUG
+# define dbg_printf(...) printf(__VA_ARGS__)
+#else
+# define dbg_printf(...)
+#endif
+
+/* do not change the following! */
+#ifdef DRIVER
+/* create aliases for driver tests */
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif /* def DRIVER */
+
+
+/* Basic constants and macros */
+#define WSIZE       4       /* Word and header/footer and pointer size (bytes) */
+#define DSIZE       8       /* Double word size (bytes) ,sizeof alignment*/
+#define CHUNKSIZE  (1<<12)  /* The size of one page in Linux system*/
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+
+/* 两级索引 */
+
+#define SL_BITS     3                       /* 每一行等分为2^SL_BITS个链表 */
+#define SL_NUM      (1 << SL_BITS)
+#define SMALL_BITS  (SL_BITS + 3)           /* 小于2^SMALL_BITS的块按8字节线性划分 */
+#define SMALL_BLOCK (1 << SMALL_BITS)
+#define FL_NUM      (32 - SMALL_BITS + 1)   /* 块的大小小于2^32，fl范围为[0,FL_NUM) */
+#define HEADNUM     (FL_NUM * SL_NUM)       /* 链表的个数 */
+#define HEAD_PAD    (((1 + FL_NUM + HEADNUM) % 2) ? 0 : 1) /* 使序言块8字节对齐的填充字数 */
+#define PREFIX_WORDS (1 + FL_NUM + HEADNUM + HEAD_PAD)     /* 序言块之前的字数 */
+
+
+/* Pack a size and allocated bit into a word */
+#define PACK(size, alloc)  ((size) | (alloc))
+
+/* Read and write a word at address p */
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+
+
+/* 指针操作，与mm.c相同 */
+#define PTR_VALUE(p)    ((unsigned long)(p))
+#define BIAS(p)         ((unsigned long)((p) ? (0x800000000):(0)))
+#define GET_PTR(p)      ((unsigned int *)((BIAS(GET(p))) + (unsigned long)(GET(p))))
+#define PUT_PTR(p, ptr) (*(unsigned int *)(p) = (unsigned int)((PTR_VALUE(ptr)) - (BIAS(ptr))))
+
+/* 空闲块的前驱和后继 */
+#define PRED(p)  (GET_PTR(p))
+#define SUCC(p)  (GET_PTR((char*)(p) + WSIZE))
+#define SET_PRED(p,ptr) (PUT_PTR((p),(ptr)))
+#define SET_SUCC(p,ptr) (PUT_PTR(((char*)(p) + WSIZE),(ptr)))
+
+
+/* 位图与表头 */
+
+/* 第一级位图，存放在堆的第一个字中 */
+#define FL_MAP          (GET(sl_map - WSIZE))
+/* 第fl行的第二级位图 */
+#define SL_MAP(fl)      (GET(sl_map + (fl) * WSIZE))
+/* 存放链表(fl,sl)表头的位置 */
+#define HEAD(fl,sl)     (seg_list + ((fl) * SL_NUM + (sl)) * WSIZE)
+
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Given block ptr bp, compute address of its header and footer */
+#define HDRP(bp)       ((char *)(bp) - WSIZE)
+#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp, compute address of next and previous blocks */
+#define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
+#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
+
+/* 前一个块是否被分配，以及维护下一个块header的倒数第二位，与mm.c相同 */
+#define GET_PREV_ALLOC(bp) (GET(HDRP(bp)) & 0x2)
+#define SET_NEXT_ALLOC(bp) (GET(HDRP(NEXT_BLKP(bp))) |= 0x2)
+#define SET_NEXT_FREE(bp)  (GET(HDRP(NEXT_BLKP(bp))) &= (~0x2))
+#define R_PUT(p,val) (*(unsigned int *)(p) = ((GET(p) & 0x2) | val))
+
+
+/* Global variables */
+static char *heap_listp = 0;  /* Pointer to first block */
+static char *sl_map = 0;      /* 第二级位图的起始位置 */
+static char *seg_list = 0;    /* 第一个链表的表头 */
+
+
+/* Function prototypes for internal helper routines */
+static void *extend_heap(size_t words);
+static void place(void *bp, size_t asize);
+static void *find_fit(size_t asize);
+static void *coalesce(void *bp);
+static void mapping(size_t size, int *fl, int *sl); /* 计算大小为size的块所在的链表(fl,sl) */
+static void insert_list(void *bp);
+static void delete_list(void *bp);
+
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+
+
+/*
+ * Initialize: return -1 on error, 0 on success.
+ * Reset all the global pointers, clear both levels of bitmaps and all list heads.
+ */
+int mm_init(void) {
+
+    /* Reset the global pointers */
+    heap_listp = NULL;
+    sl_map = NULL;
+    seg_list = NULL;
+
+    /* Create the initial empty heap */
+    if ((heap_listp = mem_sbrk((PREFIX_WORDS + 3)*WSIZE)) == (void *)-1)
+        return -1;
+
+    for(int i = 0;i < PREFIX_WORDS;++i){
+        PUT(heap_listp + (i*WSIZE), 0);
+    }
+    PUT(heap_listp + (PREFIX_WORDS)*WSIZE, PACK(DSIZE, 1));     /* Prologue header */
+    PUT(heap_listp + (PREFIX_WORDS + 1)*WSIZE, PACK(DSIZE, 1)); /* Prologue footer */
+    PUT(heap_listp + (PREFIX_WORDS + 2)*WSIZE, PACK(0, 1));     /* Epilogue header */
+    sl_map = heap_listp + WSIZE;
+    seg_list = sl_map + FL_NUM*WSIZE;
+    heap_listp += ((PREFIX_WORDS + 1) * WSIZE);  /*the block pointer of Prologue block */
+    SET_NEXT_ALLOC(heap_listp);
+
+    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
+    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * malloc - Ask for a block, constant time unless the heap has to grow
+ */
+void *malloc (size_t size) {
+
+    size_t asize;      /* Adjusted block size */
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;
+
+    if (heap_listp == NULL){
+        mm_init();
+    }
+
+    /* Ignore spurious requests */
+    if (size == 0)
+        return NULL;
+
+    /* Adjust block size to include header,footer and pointers*/
+    if (size <= DSIZE)
+        asize = 2*DSIZE;
+    else
+        asize = DSIZE * ((size + WSIZE + (DSIZE-1)) / DSIZE);
+        /* 已分配块不需要footer，所以只需要加上header的大小，即一个WSIZE */
+
+    /* Search the free list for a fit */
+    if ((bp = find_fit(asize)) != NULL) {
+        place(bp, asize);
+        return bp;
+    }
+
+    /* No fit found. Get more memory and place the block */
+    extendsize = MAX(asize,CHUNKSIZE);
+    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
+        return NULL;
+    place(bp, asize);
+    return bp;
+}
+
+/*
+ * free - Free a block, constant time
+ */
+void free (void *bp) {
+
+    if (bp == NULL)
+        return;
+
+    size_t size = GET_SIZE(HDRP(bp));
+    if (heap_listp == 0){
+        mm_init();
+    }
+
+    /* The second bit should be saved */
+    R_PUT(HDRP(bp), PACK(size, 0));
+    R_PUT(FTRP(bp), PACK(size, 0));
+    SET_NEXT_FREE(bp);
+
+    coalesce(bp);
+}
+
+
+/*
+ * realloc - change the size of an allocated block
+ *
+ * 缩小时原地分割；增大时若下一个块空闲且合并后足够大则原地扩展，否则malloc、拷贝、free
+ */
+void *realloc(void *oldptr, size_t size) {
+    size_t asize;
+    size_t oldsize;
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(oldptr == NULL) {
+        return malloc(size);
+    }
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+        free(oldptr);
+        return NULL;
+    }
+
+    oldsize = GET_SIZE(HDRP(oldptr));
+
+    if(size <= DSIZE){
+        asize = 2*DSIZE;
+    }else{
+        asize = DSIZE * ((size + WSIZE + (DSIZE-1))/DSIZE);
+    }
+
+    if(asize > oldsize){
+        void * next = NEXT_BLKP(oldptr);
+        size_t nsize = GET_SIZE(HDRP(next));
+
+        if(!GET_ALLOC(HDRP(next)) && (oldsize + nsize >= asize)){
+            /* 吸收下一个空闲块，再把多余的部分分割出去 */
+            delete_list(next);
+            R_PUT(HDRP(oldptr), PACK(oldsize + nsize, 1));
+            SET_NEXT_ALLOC(oldptr);
+            oldsize += nsize;
+        }else{
+            void * newptr = malloc(size);
+
+            /* If realloc() fails the original block is left untouched  */
+            if(!newptr) {
+                return 0;
+            }
+            memcpy(newptr, oldptr, oldsize - WSIZE);
+            free(oldptr);
+            return newptr;
+        }
+    }
+
+    size_t csize = oldsize - asize;
+
+    if(csize >= 2*DSIZE){
+        /* 新的大小asize小于块的大小，且差值不小于最小空闲块，分割出一个空闲块 */
+        R_PUT(HDRP(oldptr),PACK(asize,1));
+        SET_NEXT_ALLOC(oldptr);
+
+        void * cp = NEXT_BLKP(oldptr);
+        R_PUT(HDRP(cp),PACK(csize,0));
+        PUT(FTRP(cp),PACK(csize,0));
+        SET_NEXT_FREE(cp);
+
+        coalesce(cp);
+    }
+
+    return oldptr;
+}
+
+
+/*
+ * calloc - malloc a block with the size of nmemb*size,and initialize it to zero
+ *          return NULL if nmemb*size overflows or malloc fails
+ */
+void *calloc (size_t nmemb, size_t size) {
+    size_t bytes = nmemb * size;
+    void *newptr;
+
+    if((size != 0) && (bytes / size != nmemb)){
+        return NULL;
+    }
+
+    newptr = malloc(bytes);
+    if(newptr != NULL){
+        memset(newptr, 0, bytes);
+    }
+
+    return newptr;
+}
+
+
+
+/*
+ * extend_heap - Extend heap with free block and return its block pointer
+ */
+static void *extend_heap(size_t words)
+{
+    char *bp;
+    size_t size;
+
+    /* Allocate an even number of words to maintain alignment */
+    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+
+    if ((long)(bp = mem_sbrk(size)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header */
+    R_PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
+    R_PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+    /* Coalesce if the previous block was free */
+    return coalesce(bp);
+}
+
+
+/*
+ * place - Place block of asize bytes at start of free block bp
+ *         and split if remainder would be at least minimum block size
+ */
+static void place(void *bp, size_t asize)
+{
+    size_t csize = GET_SIZE(HDRP(bp));
+
+    delete_list(bp);
+
+    if ((csize - asize) >= (2*DSIZE)) {
+
+        R_PUT(HDRP(bp), PACK(asize, 1));
+        SET_NEXT_ALLOC(bp);
+
+        bp = NEXT_BLKP(bp);
+
+        /* 原来的块是空闲的，其后一个块一定已分配，剩余部分无需合并 */
+        R_PUT(HDRP(bp), PACK(csize-asize, 0));
+        R_PUT(FTRP(bp), PACK(csize-asize, 0));
+        SET_NEXT_FREE(bp);
+        insert_list(bp);
+    }
+    else {
+        R_PUT(HDRP(bp), PACK(csize, 1));
+        SET_NEXT_ALLOC(bp);
+    }
+}
+
+
+/*
+ * coalesce - Boundary tag coalescing. Return ptr to coalesced block
+ * The coalesced block will be inserted into the free block list
+ */
+static void *coalesce(void *bp)
+{
+    size_t prev_alloc = (GET_PREV_ALLOC(bp) >> 1); /* 不能使用PREV_BLKP，因为前一个块不一定有footer */
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if (prev_alloc && next_alloc) {            /* Case 1 */
+        SET_NEXT_FREE(bp);
+        insert_list(bp);
+        return bp;
+    }
+
+    else if (prev_alloc && !next_alloc) {      /* Case 2 */
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        delete_list(NEXT_BLKP(bp));
+        R_PUT(HDRP(bp), PACK(size, 0));
+        R_PUT(FTRP(bp), PACK(size, 0));
+    }
+
+    else if (!prev_alloc && next_alloc) {      /* Case 3 */
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        delete_list(PREV_BLKP(bp));
+        R_PUT(FTRP(bp), PACK(size, 0));
+        R_PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        bp = PREV_BLKP(bp);
+    }
+
+    else {                                     /* Case 4 */
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
+            GET_SIZE(FTRP(NEXT_BLKP(bp)));
+        delete_list(PREV_BLKP(bp));
+        delete_list(NEXT_BLKP(bp));
+        R_PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        R_PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        bp = PREV_BLKP(bp);
+    }
+
+    SET_NEXT_FREE(bp);
+    insert_list(bp);
+    return bp;
+}
+
+
+/*
+ * mapping - Given the size of a block, compute the list (fl,sl) it belongs to
+ */
+static void mapping(size_t size, int *fl, int *sl){
+
+    if(size < SMALL_BLOCK){
+        *fl = 0;
+        *sl = (int)(size >> 3);
+    }else{
+        int bit = 63 - __builtin_clzl(size); /* the highest valid bit of size */
+        *fl = bit - SMALL_BITS + 1;
+        *sl = (int)((size >> (bit - SL_BITS)) ^ SL_NUM);
+    }
+}
+
+
+/*
+ * find_fit - Find a fit for a block with asize bytes in constant time
+ *
+ * asize先向上取整到所在区间的上界，再借助两级位图找到第一个不小于该区间的非空链表，
+ * 取其第一个块。若不存在这样的链表，最后检查asize所在链表的第一个块是否恰好足够大。
+ */
+static void *find_fit(size_t asize)
+{
+    int fl, sl;
+    size_t rsize = asize;
+
+    if(asize >= SMALL_BLOCK){
+        rsize += (1UL << (63 - __builtin_clzl(asize) - SL_BITS)) - 1;
+    }
+    mapping(rsize, &fl, &sl);
+
+    if(fl < FL_NUM){
+        unsigned int map = SL_MAP(fl) & (~0u << sl);
+
+        if(map == 0){
+            /* 第fl行没有可用的链表，到第一级位图中找更大的一行 */
+            map = FL_MAP & (~0u << (fl + 1));
+            if(map != 0){
+                fl = __builtin_ctz(map);
+                map = SL_MAP(fl);
+            }
+        }
+
+        if(map != 0){
+            sl = __builtin_ctz(map);
+            return GET_PTR(HEAD(fl,sl));
+        }
+    }
+
+    /* asize所在的链表中，第一个块也可能足够大 */
+    mapping(asize, &fl, &sl);
+    void * bp = GET_PTR(HEAD(fl,sl));
+    if((bp != NULL) && (GET_SIZE(HDRP(bp)) >= asize)){
+        return bp;
+    }
+    return NULL;
+}
+
+
+/*
+ * insert_list - Push the free block bp onto the head of its list (fl,sl)
+ *               and mark the list as non-empty in both bitmaps
+ */
+static void insert_list(void * bp){
+
+    int fl, sl;
+    mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+    void * list_head = GET_PTR(HEAD(fl,sl));
+
+    SET_PRED(bp,NULL);
+    SET_SUCC(bp,list_head);
+    if(list_head != NULL){
+        SET_PRED(list_head,bp);
+    }
+    PUT_PTR(HEAD(fl,sl),bp);
+
+    PUT(sl_map + fl*WSIZE, SL_MAP(fl) | (1u << sl));
+    PUT(sl_map - WSIZE, FL_MAP | (1u << fl));
+}
+
+
+/*
+ * delete_list - Remove the free block bp from its list (fl,sl),
+ *               clear the bitmap bits if the list becomes empty
+ */
+static void delete_list(void * bp){
+
+    int fl, sl;
+    mapping(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+    void * pred = PRED(bp);
+    void * succ = SUCC(bp);
+
+    if(succ != NULL){
+        SET_PRED(succ,pred);
+    }
+
+    if(pred != NULL){
+        SET_SUCC(pred,succ);
+    }else{
+        /* bp为表头 */
+        PUT_PTR(HEAD(fl,sl),succ);
+        if(succ == NULL){
+            PUT(sl_map + fl*WSIZE, SL_MAP(fl) & ~(1u << sl));
+            if(SL_MAP(fl) == 0){
+                PUT(sl_map - WSIZE, FL_MAP & ~(1u << fl));
+            }
+        }
+    }
+
+    SET_PRED(bp,NULL);
+    SET_SUCC(bp,NULL);
+}
+
+
+
+
+/*
+ * Return whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static int in_heap(const void *p) {
+    return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+    return (size_t)ALIGN((size_t)p) == (size_t)p;
+}
+
+
+/*
+ * mm_checkheap
+ */
+void mm_checkheap(int lineno) {
+
+    /*check heap boundaries*/
+    size_t upper_lim = 0x100000000;
+
+    if(mem_heapsize() >= upper_lim){
+        printf("%d:The size of heap is too large!\n",lineno);
+        return;
+    }
+    /* check prologue block */
+    if((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp))){
+        printf("%d:Prologue block: %u error\n",lineno,GET(HDRP(heap_listp)));
+        return;
+    }
+
+
+    /*iterate all the blocks in heaps and check them one after another */
+
+    unsigned int MINSIZE = 2*DSIZE;
+    void * bp = NEXT_BLKP(heap_listp);
+    int free_blocks = 0;
+
+    int last_block_alloc = 1; //record the allocate bit of last block,initialized to 1
+    for(;GET_SIZE(HDRP(bp)) > 0;bp = NEXT_BLKP(bp)){
+        if(!in_heap(bp)){
+            printf("%d:Block not in the heap,SEGV!\n",lineno);
+            return;
+        }
+        if(!aligned(bp)){
+            printf("%d:Address not aligned to 8 bytes!\n",lineno);
+            return;
+        }
+        if(GET_SIZE(HDRP(bp)) < MINSIZE){
+            printf("%d:Block Size %u not large enough,bp = %lx\n",lineno,GET_SIZE(HDRP(bp)),PTR_VALUE(bp));
+        }
+
+        /* 倒数第二位应与前一个块的分配情况一致 */
+        if((GET_PREV_ALLOC(bp) >> 1) != (unsigned int)last_block_alloc){
+            printf("%d:Prev-alloc bit wrong at %lx\n",lineno,PTR_VALUE(bp));
+            return;
+        }
+
+        void * head = HDRP(bp);
+        void * foot = FTRP(bp);
+
+        if((!GET_ALLOC(head)) && ((GET(head) & (~0x2)) != (GET(foot) & (~0x2)))){
+            printf("%d:Header and Footer not matching each other\n",lineno);
+            return;
+        }
+
+        if(!last_block_alloc && !GET_ALLOC(HDRP(bp))){
+            printf("%d:Two consecutive free blocks\n",lineno);
+            return;
+        }
+
+        if(!GET_ALLOC(head)){
+            free_blocks++;
+        }
+        last_block_alloc = GET_ALLOC(HDRP(bp));
+    }
+    /*check epilogue block*/
+    if(!GET_ALLOC(HDRP(bp))){
+        printf("%d:Epilogue block error\n",lineno);
+        return;
+    }
+
+
+    /*check the free block lists and both levels of bitmaps*/
+    int listed_blocks = 0;
+    for(int fl = 0;fl < FL_NUM;++fl){
+
+        if(((FL_MAP >> fl) & 1) != (SL_MAP(fl) != 0)){
+            printf("%d:First level bitmap bit %d wrong\n",lineno,fl);
+            return;
+        }
+
+        for(int sl = 0;sl < SL_NUM;++sl){
+            bp = GET_PTR(HEAD(fl,sl));
+
+            if(((SL_MAP(fl) >> sl) & 1) != (bp != NULL)){
+                printf("%d:Second level bitmap bit (%d,%d) wrong\n",lineno,fl,sl);
+                return;
+            }
+
+            void * pred = NULL;
+            for(;bp != NULL;pred = bp,bp = SUCC(bp)){
+                int bfl, bsl;
+
+                if(!in_heap(bp)){
+                    printf("%d:Block %lx in list (%d,%d) not in the heap\n",lineno,PTR_VALUE(bp),fl,sl);
+                    return;
+                }
+                if(GET_ALLOC(HDRP(bp))){
+                    printf("%d:An allocated block in the free list (%d,%d)\n",lineno,fl,sl);
+                    return;
+                }
+                if(PRED(bp) != pred){
+                    printf("%d:previous pointer not consistent in list (%d,%d)\n",lineno,fl,sl);
+                    return;
+                }
+                mapping(GET_SIZE(HDRP(bp)), &bfl, &bsl);
+                if((bfl != fl) || (bsl != sl)){
+                    printf("%d:Block of size %u in the wrong list (%d,%d)\n",lineno,GET_SIZE(HDRP(bp)),fl,sl);
+                    return;
+                }
+                listed_blocks++;
+            }
+        }
+    }
+
+    if(listed_blocks != free_blocks){
+        printf("%d:%d free blocks in the heap but %d in the lists\n",lineno,free_blocks,listed_blocks);
+    }
+}
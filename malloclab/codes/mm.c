@@ -9,22 +9,31 @@
  * 1.添加了一些操作指针的宏，简化关于指针的coding。为节省空间，指针在堆中以4字节的形式存在。
  *   因为指针从0x800000000处开始，所以将8字节非零指针转换为4字节需要减去一个BIAS。
  * 
- * 2.一共有10个链表，每个链表对应的空闲块大小分别位于区间[1,32),[32,64),[64,128),[128,256),[256,512),
+ * 2.默认一共有10个链表，每个链表对应的空闲块大小分别位于区间[1,32),[32,64),[64,128),[128,256),[256,512),
  *   [512,1024),[1024,2048),[2048,4096),[4096,8192),[8192,+INF)。
+ *   编译时定义SUBLIST_BITS为1或2，可以把[8192,+INF)以外的每个区间再等分为2或4个子区间（类似TLSF），
+ *   链表个数随之变为19或37。链表的索引由__builtin_clzl求出最高有效位后查表得到，无需循环。
  *   链表内部的空闲块按照从小到大排序，采用这种方法可以在搜索时，使首次试配的块最佳适配。
- *   10个链表的表头指针存放于序言块的之前40个字节。
+ *   所有链表的表头指针存放于序言块之前。
+ *   表头之前的8个字节存放非空链表的位图，第i位为1表示第i个链表非空，
+ *   搜索时可以借助count-trailing-zeros指令直接跳到第一个可用的非空链表，跳过所有空链表。
+ *   最后两个链表（索引不小于TREE_LIST）中的空闲块可能多达数千个，线性插入和搜索代价过高，
+ *   因此改用以(大小,地址)为键的treap组织，插入、删除、最佳适配均为期望O(log n)。
+ *   treap的左右孩子指针复用空闲块中前驱、后继指针的位置，优先级由块地址散列得到，无需额外空间。
+ *   位图和链表表头之后是SLAB_NUM个slab表头，见6。
  *  
  * 3.已分配块不需要用到foot，所以在malloc时可以少申请4个字节，从而提高内存利用率。
  *   为了实现这种方法，需要在每一个块的head的倒数第二位记录前一个块是否被allocated，因此需要改写textbook.c中定义的宏。(R_PUT)
  * 
  * 4.堆的结构：（每个方块为4字节）
  *    
- *    __________________________________________________________________________
- *    | 占用 | 表头1 | 表头2 | ... | 表头10 | 序言块 | 序言块 | 堆开始 | ... | 结尾块 |
- *    |_____|_______|______|_____|_______|__8/1__|__8/1__|_______|_____|__0/1__|
- *          ^                                    ^       
- *          |                                    |
- *        seg_list                            heap_listp
+ *    ___________________________________________________________________________________________
+ *    | 位图 | 位图 | 表头1 | 表头2 | ... | 表头10 | slab表头1 | ... | slab表头7 | 填充 | 序言块 | 序言块 | 堆开始 | ... | 结尾块 |
+ *    |_____|_____|_______|______|_____|_______|__________|_____|__________|_____|__8/1__|__8/1__|_______|_____|__0/1__|
+ *                ^                                          ^       
+ *                |                                          |
+ *              seg_list                                  heap_listp
+ *   （表头个数为奇数时没有填充字）
  *              
  *   已分配块的结构：
  * 
@@ -60,6 +69,136 @@
  *      |_______________________|__|_________|_______| 
  * 
  * 
+ * 5.编译时定义MM_THREADS可以得到线程安全的版本：
+ *   (1)堆被分为MM_ARENAS个arena，每个arena有自己的锁、位图和表头，线程第一次使用时按轮转分配到一个arena，
+ *      此后只在该arena中分配，不同arena的线程互不争用锁，也不会在同一组表头上来回传递cache line。
+ *      arena 0的表头位于堆的开头，其余arena的表头位于静态的arena结构中，当前线程所用的表头由线程局部的seg_list指向。
+ *   (2)每个arena的内存由若干段组成，段都从mem_sbrk得到，且以GRAN字节为粒度：一个粒度只属于一个arena，
+ *      arena_of表记录每个粒度的主人，由块的地址即可查出块属于哪个arena。堆顶的段属于自己时直接向后延伸；
+ *      否则在粒度边界处开始一个新段，原来的结尾块变成一个已分配的间隔块，因此整个堆仍可以从头到尾遍历，
+ *      而不同arena的块永远不会被合并。
+ *   (3)释放其他arena的块时不加锁，而是用CAS压入该arena的remote栈，主人在下一次持锁时一次性取出并释放。
+ *   (4)每个线程另有一个线程局部的缓存，大小不超过TC_MAX的块按大小每8字节一类，用单向链表（栈）缓存。
+ *      free时块直接压入缓存，malloc时优先从缓存弹出，这两条快速路径都不访问共享的状态，也不加锁。
+ *      缓存为空时加锁一次，从自己的arena中批量取出TC_FILL个块；缓存中的块超过TC_LIMIT个时加锁一次，
+ *      批量归还一半。缓存中的块在堆看来仍是已分配的，线程退出时其缓存全部归还。
+ *      slab的每一类同样各有一类缓存。
+ * 
+ * 6.不超过slab_limit（至多SLAB_MAX）字节的请求由slab分配，不占用最小16字节的块，也没有header：
+ *   slab的每一类对应一个8字节的倍数，对象放在该类的run中。run是一个有效载荷按页对齐、大小恰好为一页的已分配块，
+ *   header位于前一页的最后一个字，本页的最后一个字是下一块的header；alloc_aligned在空闲块中找对齐点放得下的位置，
+ *   找不到时只把堆扩展到堆顶恰好放得下，不多取一页再分割。
+ *   开头RUN_HDR字节依次为槽的大小、空闲槽数、前驱、后继以及512位的空闲槽位图，其后是大小相同的槽。
+ *   每一类有空闲槽的run组成双向链表，表头位于分离链表的表头之后，分配时在第一个run的位图中用ctz取空闲槽。
+ *   run中的槽全部空闲时，除非它是该类唯一的run，否则整个run归还给堆。
+ *   堆之外用mmap得到的slab_map为每页记录一个字节，表示该页是否为run，free由此判断对象是否属于slab。
+ *   每一类即使只有一个对象也占用一整页，驱动程序的小trace上利用率明显下降（总利用率63.8%，关闭时67.6%），
+ *   因此定义DRIVER时slab_limit默认为0，吞吐量优先时用mm_mallopt(MM_SLAB_LIMIT, SLAB_MAX)打开。
+ * 
+ * 7.不小于mmap_threshold字节的请求直接用mmap得到一段单独的映射，不放在堆中，free时munmap归还给系统，
+ *   realloc时用mremap改变大小，无需复制。映射开头的8个字节记录映射的长度，有效载荷之前的header为PACK(0,1)。
+ *   堆中的块都位于0x800000000开始的4GB之内（4字节指针的要求），映射的块都在其外，由地址即可区分。
+ *   阈值可以用mm_mallopt(MM_MMAP_THRESHOLD, value)在运行时修改，0表示不使用mmap。
+ *   驱动程序要求有效载荷位于堆中，因此定义DRIVER时默认为0。
+ * 
+ * 8.memlib不支持负的mem_sbrk，堆无法收缩，因此用madvise(MADV_DONTNEED)把空闲块内部整页的物理内存还给系统，
+ *   块的header、前驱、后继和footer所在的页保留，之后再次写入这些页时系统自动分配清零的页。
+ *   free之后堆顶的空闲块不小于trim_threshold（可用mm_mallopt(MM_TRIM_THRESHOLD, value)修改，
+ *   0表示不自动释放）时自动释放；place分割堆顶的块时不释放，否则几乎每次malloc都要madvise。
+ *   定义DRIVER时trim_threshold默认为0：trace中堆顶反复释放又写入，每次都要madvise再缺页。
+ *   mm_trim(pad)释放所有空闲块，堆顶的空闲块开头保留pad字节。
+ *   released记录最近一次释放的整页，place和realloc写入其中时随之缩小，再次释放时跳过其中的页；
+ *   已知为0的块内部的整页不曾被写过或者已经释放过，也不再释放。
+ * 
+ * 9.realloc的几何增长（mm_mallopt(MM_REALLOC_GROWTH, percent)，percent大于100时开启，默认关闭）：
+ *   realloc扩大块时在已分配块header的倒数第三位记录该块被扩大过；再次扩大这样的块时，
+ *   新的大小至少为原来的percent%，多出的部分作为块内的预留，之后的realloc只要不超过块的大小就直接返回，
+ *   缩小到不足一半之前也不分割。被扩大过的块没有footer，其最后一个字记录调用者最近一次请求的字节数，
+ *   开启时realloc为此多申请一个字；请求比上一次大、由预留满足而省去一次复制的次数由mm_realloc_reserve_hits()给出。
+ *   加上预留达到mmap_threshold时不留预留，映射的块由mremap扩大（见7）。
+ * 
+ * 10.空闲块header和footer的倒数第三位表示该块已知为0：除header、前驱、后继和footer之外的字节全为0。
+ *   zero_brk记录mem_sbrk曾经到达的最高地址，其上的内存从未被写过，extend_heap由此得到的块已知为0；
+ *   place分割已知为0的块时剩余部分仍为0；coalesce合并的块都已知为0时，把交界处的footer、header、
+ *   前驱、后继清零，合并后的块仍为0；release_block释放整页之后把剩余部分清零，整个块也为0。
+ *   calloc得到的块若由place从已知为0的块中分配，只需把前驱、后继以及最后一个字清零：place不写已分配块的footer，
+ *   但块未分割时原空闲块的footer留在那里，分割时那里是空闲块的内部，已经为0。
+ *   映射的块则完全不用清零。calloc同时检查nmemb*size溢出以及分配失败。
+ * 
+ * 11.大小取整：binary一类的trace交替分配64和448字节的块，释放全部448字节的块之后请求512字节，
+ *   留下的空洞刚好不够用。原来的特定优化把439~451字节的请求取整为512，这里保留为预置规则，并加以限制：
+ *   malloc直接请求452~511字节的块时，这些请求会自己分配，取整留下的余量只是浪费（gen-near512），
+ *   这样的请求超过被取整的块数的1/SEED_GATE后停用预置规则，直到下一次mm_init。
+ *   realloc复制时的请求正好受益于余量（gen-realloc），不计入。mm_size_rounding()给出预置规则是否仍在生效。
+ *   曾经尝试在find_fit失败时观察刚好不够用的空洞，学习取整规则来代替它，但学到的规则只能在空洞出现之后生效，
+ *   binary中512字节的请求到来时448字节的块早已分配完，其余trace上学到的规则也不改变利用率，因此没有保留。
+ * 
+ * 12.mm_stats()给出堆的统计信息：extend_heap的次数、coalesce四种情况各自的次数、find_fit查看的空闲块数、
+ *   realloc原地完成与复制的次数等计数器在热路径上直接累加，每次只多一条加法；
+ *   每个链表中空闲块的字节数和块数由insert_list、delete_list维护，堆中块的总数在分割、合并时加减，
+ *   已分配的字节数和块数由它们和堆的大小算出，mm_stats不遍历堆。mm_checkheap核对这些计数器与遍历的结果。
+ * 
+ * 13.编译时定义MM_LATENCY可以得到计时的版本：malloc、free、realloc、calloc每LAT_SAMPLE次调用抽取一次
+ *   （可用mm_mallopt(MM_LAT_SAMPLE, n)修改，0表示不抽样），用rdtsc计时，按周期数的以2为底的对数记入该操作的直方图。
+ *   抽中的调用中如果发生了extend_heap、find_fit或insert_list查看了超过LAT_LONG_SCAN个块，
+ *   该次的耗时同时记入对应慢路径的直方图，由此可以区分尾延迟来自链表遍历还是堆的扩展。
+ *   mm_latency()读出、mm_latency_reset()清空所有直方图。未定义MM_LATENCY时这些代码都不存在。
+ * 
+ * 14.mm_snapshot(fp, format)像mm_checkheap一样从序言块遍历到结尾块，把每个块的偏移、大小、标志、
+ *   所在的链表（以及所属的arena）以JSON或紧凑的二进制格式写入fp，JSON中另附碎片的概要；
+ *   mm_fragmentation(fp)以文本输出概要：最大空闲块、外部碎片率（1-最大空闲块/空闲字节数）以及每个链表中空闲块的个数、
+ *   字节数和大小范围。不同时刻的快照可以直接比较，找出利用率下降的原因。
+ * 
+ * 15.增量检查：mm_checkheap遍历整个堆和所有链表，代价与堆的大小成正比。mm_check_step(budget)从上次停下的块
+ *   （check_cursor）开始只检查budget个块，到达结尾块后回到堆的开头。每个块检查边界、对齐、大小、header与footer、
+ *   下一个块的倒数第二位；空闲块还检查它在链表中的邻居：前驱的后继（或表头）是它、后继的前驱是它、大小有序、
+ *   位图中对应的位为1，treap中的结点检查两个孩子的键与优先级；slab的run检查空闲槽的计数。
+ *   出错时输出块的地址、相对堆起点的偏移、header以及违反的条件。coalesce、realloc合并掉check_cursor所在的块时
+ *   把它移到合并后的块，所以游标总是指向一个块的开头。mm_mallopt(MM_CHECK_INTERVAL, n)使malloc、free、realloc
+ *   每n次调用自动检查MM_CHECK_SLICE个块，0表示关闭（默认）。
+ * 
+ * 16.可调的策略集中在mm_config.h：扩展堆的最小字节数CHUNKSIZE、分割的阈值SPLIT_MIN、分离链表的划分
+ *   （FIRST_BAND_BITS、BANDNUM、SUBLIST_BITS）、slab的上限以及各项阈值的初值，
+ *   均可在编译时用-D覆盖。其中不影响堆的布局的几项保存在变量中，mm_mallopt可以修改，
+ *   mm_init还会读取同名的环境变量（如MM_CHUNK_SIZE=16384），按服务调整而无需修改源码。
+ * 
+ * 17.延迟合并：不超过QUICK_MAX字节的块free时不合并，保持已分配的状态（header不变），按大小每8字节一类
+ *   压入快速链表（单向链表，链接指针位于有效载荷的第一个字），malloc同样大小的块时直接弹出，不查找、不分割。
+ *   表头与总字节数同mm_stats的计数器一样放在堆外（单线程时为全局变量，线程安全的版本中在struct arena中），
+ *   不改变堆的布局——序言块之前哪怕多几个字，之后所有块相对页的位置都会变化，利用率随之波动。
+ *   总字节数超过quick_limit，或者find_fit失败、需要扩展堆之前，quick_flush批量处理所有的块：先全部标为空闲，
+ *   再把地址相邻的一段直接拼成一个块，每一段只与分离链表中的邻居合并、插入链表一次。
+ *   销毁对象图时的大量free只是压栈，之后同样大小的malloc也无需查找。
+ *   mm_trim需要归还快速链表中的块，因此先批量合并；mm_stats、mm_snapshot、mm_fragmentation只读取堆，
+ *   不合并，把其中的块单独报告为延迟释放（字节数、块数和每一类的块数），不计入已分配。
+ *   mm_mallopt(MM_QUICK_LIMIT, 0)关闭延迟合并，已在快速链表中的块仍可被malloc取走或在下一次批量合并时合并。
+ *   驱动程序按利用率评分，定义DRIVER时默认关闭。线程安全的版本中每个arena有自己的快速链表，
+ *   但不超过TC_MAX的块通常已被线程缓存截留。
+ * 
+ * 18.批量接口：mm_malloc_batch(size, n, out)先从快速链表中取同样大小的块，其余的用一次alloc_block得到
+ *   一个不小于k*asize的块，再直接写k个header切分，最后一块拿走place留下的零头。
+ *   mm_free_batch(ptrs, n)把ptrs按地址原地排序（已经有序时不排序），地址相邻的一段块直接拼成一个空闲块，
+ *   只调用一次coalesce，与quick_flush的做法相同，因此不再经过快速链表。
+ * 
+ * 19.mm_free_sized(ptr, size)：调用者给出分配时的大小，堆中的块不读header，直接按ADJUST_SIZE(size)压入快速链表
+ *   （线程安全的版本中为线程缓存）。块的实际大小可能更大（place不分割的零头、取整规则、realloc），
+ *   因此快速链表中的块只保证不小于所在的类，弹出的块仍能满足请求，批量合并时按header恢复真实大小。
+ *   映射的块和slab的槽由地址与slab_map区分，同free处理。编译时定义MM_SIZED_CHECK则先从两侧核对header：
+ *   size大于块的容量，或者块比按size分配所能得到的最大的块（取整规则、缓存行、place不分割的零头）还大时，
+ *   报告并按header释放；被realloc扩大过的块带有预留，不报告，同样按header释放。
+ * 
+ * 20.对齐分配：mm_memalign(alignment, size)、mm_posix_memalign、mm_aligned_alloc。alignment不超过DSIZE时同malloc，
+ *   否则由alloc_aligned（原本只用来取slab的run）从堆中取一个对齐点放得下的空闲块（见6），对齐点之前的部分
+ *   分割出来成为空闲块与前面合并，之后多余的部分同样分割。返回的是普通的已分配块，free、realloc无需特殊处理。
+ * 
+ * 21.按缓存行放置：mm_mallopt(MM_CACHE_ALIGN, n)之后，不超过n字节的请求不再由slab、线程缓存或快速链表满足，
+ *   而是用alloc_aligned取一个有效载荷从行首（CACHE_LINE字节对齐）开始、大小取整到整数个行的块，
+ *   不同的对象（包括不同线程的对象）的有效载荷不会落在同一行中，避免伪共享；只有下一块的header位于本块最后一行的末尾。
+ *   aligned_fit先在链表中找已经放得下对齐的块的空闲块，找不到时只把堆扩展到堆顶放得下，不多取align+2*DSIZE字节
+ *   再分割两次。这样的块连续分配时，剩余的空闲块恰好从下一行开始，不需要分割前导的零头；对齐产生的零头与末尾多余的部分
+ *   都经coalesce回到空闲链表。每个对象至少占一行，make test以MM_CACHE_ALIGN=64重放trace：
+ *   利用率由75.6%降到67.5%，吞吐量大致相当。块释放后与普通的块一样，可能被其他大小的请求复用。默认关闭，环境变量MM_CACHE_ALIGN同名。
+ * 
  * – 
  *                       
  * 
@@ -67,15 +206,23 @@
  * 
  * 
  */
+#define _GNU_SOURCE /* mremap */
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "mm.h"
+#include "mm_config.h"
 #include "memlib.h"
 
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
 #define DEBUG
@@ -107,15 +254,86 @@
 /* Basic constants and macros */
 #define WSIZE       4       /* Word and header/footer and pointer size (bytes) */ 
 #define DSIZE       8       /* Double word size (bytes) ,sizeof alignment*/
-#define CHUNKSIZE  (1<<12)  /* The size of one page in Linux system*/  
-#define LISTNUM     10      /* 空闲链表的个数，可依据实际情况改动 */
 #define MAX(x, y) ((x) > (y)? (x) : (y))  
+#define MIN(x, y) ((x) < (y)? (x) : (y))  
+
+
+/* 分离链表的划分 */
+
+/* 区间的个数BANDNUM、第一个区间的上界以及子区间的个数见mm_config.h，默认为[1,32),[32,64),...,[8192,+INF) */
+#define SUBNUM      (1 << SUBLIST_BITS)
+#define LISTNUM     ((BANDNUM - 1) * SUBNUM + 1) /* 空闲链表的个数，最后一个区间不再细分 */
+#define MAP_WORDS   2                       /* 位图占用的字数 */
+#define SLAB_NUM    (SLAB_MAX / DSIZE)      /* slab的类数，槽的大小为8,16,...,SLAB_MAX */
+#define HEAD_PAD    (((LISTNUM + SLAB_NUM) % 2) ? 0 : 1) /* 使序言块8字节对齐的填充字数 */
+#define PREFIX_WORDS (MAP_WORDS + LISTNUM + SLAB_NUM + HEAD_PAD) /* 序言块之前的字数 */
+#define HEAP_OVERHEAD ((PREFIX_WORDS + 3) * WSIZE) /* 不属于任何块的字节：开头的表头、序言块和结尾块 */
+
+/* slab */
+#define PAGE         4096
+#define RUN_HDR      80                     /* run开头的元数据：槽大小、空闲槽数、前驱、后继、8个字的位图 */
+#define SLAB_IDX(size)  (((size) + DSIZE - 1) / DSIZE - 1) /* 请求size字节的slab类 */
+#define SLAB_HEAD(c)    (seg_list + (LISTNUM + (c)) * WSIZE) /* 第c类run链表的表头 */
+/* 对象bp所在的run */
+#define RUN_OF(bp)      ((char *)(PTR_VALUE(bp) & ~(PAGE - 1)))
+#define RUN_SLOT(r)     (*(unsigned int *)(r))                    /* 槽的大小 */
+#define RUN_AVAIL(r)    (*(unsigned int *)((char *)(r) + WSIZE))  /* 空闲槽的个数 */
+#define RUN_PREV(r)     ((char *)GET_PTR((char *)(r) + DSIZE))
+#define RUN_NEXT(r)     ((char *)GET_PTR((char *)(r) + DSIZE + WSIZE))
+#define SET_RUN_PREV(r,ptr) (PUT_PTR((char *)(r) + DSIZE, (ptr)))
+#define SET_RUN_NEXT(r,ptr) (PUT_PTR((char *)(r) + DSIZE + WSIZE, (ptr)))
+#define RUN_MAP(r)      ((unsigned long *)((char *)(r) + 2*DSIZE)) /* 空闲槽位图，1表示空闲 */
+#define RUN_MAP_WORDS   8
+#define RUN_SLOTS(slot) ((PAGE - WSIZE - RUN_HDR) / (slot))       /* 一个run中槽的个数，页的最后一个字是下一块的header */
+/* slab_map为每页记录一个字节，与ARENA_OF相同，地址的低32位即是相对堆起点的偏移 */
+#define SLAB_MAP_SIZE   (1UL << (32 - 12))
+#define IS_SLAB(bp)     (slab_map[(unsigned int)PTR_VALUE(bp) >> 12])
+
+/* 增量检查：块from被合并到块to中时移动游标，使其仍指向一个块的开头 */
+#define CURSOR_MOVE(from, to) do { \
+        if (__atomic_load_n(&check_cursor, __ATOMIC_RELAXED) == (char *)(from)) \
+            __atomic_store_n(&check_cursor, (char *)(to), __ATOMIC_RELAXED); \
+    } while (0)
+/* malloc、free、realloc开头的自动检查 */
+#define CHECK_TICK() do { \
+        if ((__atomic_load_n(&check_interval, __ATOMIC_RELAXED) != 0) && (check_countdown-- <= 1)) \
+            check_tick(); \
+    } while (0)
+
+/* 预置的取整规则：大小位于[SEED_FROM,SEED_LAST]的块取整为SEED_TO，即439~451字节的请求取整为512 */
+#define SEED_FROM       ADJUST_SIZE(439)
+#define SEED_LAST       ADJUST_SIZE(451)
+#define SEED_TO         ADJUST_SIZE(512)
+#define SEED_GATE       2   /* 介于两者之间的请求超过取整的块数的1/SEED_GATE时停用 */
+
+/* 运行时可修改的策略，见mm_config.h */
+#define CHUNK()         (__atomic_load_n(&chunk_size, __ATOMIC_RELAXED))
+#define CAN_SPLIT(rest) ((rest) >= __atomic_load_n(&split_min, __ATOMIC_RELAXED)) /* 剩余rest字节时是否分割 */
+
+/* mmap：堆中的块都位于MEM_HEAP_BASE（memlib.h）开始的4GB之内，其外的块是映射的 */
+#define IS_MMAPPED(bp)  ((PTR_VALUE(bp) - MEM_HEAP_BASE) >= (1UL << 32))
+#define MMAP_LEN(bp)    (*(size_t *)((char *)(bp) - 2*DSIZE)) /* 映射的长度，位于映射的开头 */
+/* 空闲块header和footer的倒数第三位：该块已知为0 */
+#define ZERO_BIT        0x4
+#define GET_ZERO(bp)    (GET(HDRP(bp)) & ZERO_BIT)
+/* 合并后清零交界处：前一个块的footer，块bp的header、前驱、后继 */
+#define CLEAR_JOINT(bp) (memset((char *)(bp) - DSIZE, 0, 2*DSIZE))
+/* 已分配块header的倒数第三位：该块被realloc扩大过 */
+#define GET_GROWN(bp)   (GET(HDRP(bp)) & 0x4)
+#define SET_GROWN(bp)   (PUT(HDRP(bp), GET(HDRP(bp)) | 0x4))
+#define GROWN_REQ(bp)   (FTRP(bp))  /* 被扩大过的块的最后一个字：调用者最近一次请求的字节数 */
+#define PAGE_UP(size)   (((size) + PAGE - 1) & ~(size_t)(PAGE - 1))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc)) 
 
 /* Read and write a word at address p */
+#ifndef MM_THREADS
 #define GET(p)       (*(unsigned int *)(p))            
+#else
+/* 线程安全的版本中，段尾的结尾块可能正被其他arena原子地改为间隔块（见new_segment），因此读取也是原子的 */
+#define GET(p)       (__atomic_load_n((unsigned int *)(p), __ATOMIC_RELAXED))
+#endif
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
 
 
@@ -124,8 +342,8 @@
 
 /* 将指针自身的值转换为整数 */
 #define PTR_VALUE(p)    ((unsigned long)(p)) 
-/* 偏移量，如果指针非零，则为0x800000000，否则为0*/
-#define BIAS(p)         ((unsigned long)((p) ? (0x800000000):(0)))
+/* 偏移量，如果指针非零，则为MEM_HEAP_BASE（0x800000000），否则为0*/
+#define BIAS(p)         ((unsigned long)((p) ? (MEM_HEAP_BASE):(0)))
 /* 取出p指向位置的四个字节，并将其转换为八字节指针 */
 #define GET_PTR(p)      ((unsigned int *)((BIAS(GET(p))) + (unsigned long)(GET(p))))  
 /* 将指针ptr转换为四字节，存入p指向位置开始的四个字节 */
@@ -144,6 +362,30 @@
 #define SET_SUCC(p,ptr) (PUT_PTR(((char*)(p) + WSIZE),(ptr))) 
 
 
+/* 非空链表的位图，存放在第一个表头之前的8个字节中 */
+#define LIST_MAP           (*(unsigned long *)(seg_list - DSIZE))
+/* 将索引为idx的链表标记为非空/空 */
+#define MARK_LIST(idx)     (LIST_MAP |= (1UL << (idx)))
+#define UNMARK_LIST(idx)   (LIST_MAP &= ~(1UL << (idx)))
+
+
+/* p为指向treap中某一空闲块的指针，左右孩子分别存放在前驱、后继的位置 */
+
+/* 最后两个区间（默认块大小不小于4096）的链表以treap的形式组织 */
+#define TREE_LIST   ((BANDNUM - 2) * SUBNUM)
+/* 左孩子、右孩子 */
+#define LEFT(p)   (PRED(p))
+#define RIGHT(p)  (SUCC(p))
+/* 存放左孩子、右孩子的位置 */
+#define LEFT_SLOT(p)   ((char *)(p))
+#define RIGHT_SLOT(p)  ((char *)(p) + WSIZE)
+/* 结点的优先级，由块地址做乘法散列得到，不同的块优先级互不相同 */
+#define PRIO(p)   ((unsigned int)(PTR_VALUE(p) >> 3) * 2654435761u)
+/* 按(大小,地址)比较两个块，键互不相同 */
+#define TREE_LESS(a,b)  ((GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b))) || \
+                        ((GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b))) && (PTR_VALUE(a) < PTR_VALUE(b))))
+
+
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)                   
 #define GET_ALLOC(p) (GET(p) & 0x1)                    
@@ -159,8 +401,14 @@
 /* 取HDPR的倒数第二位，即前一个块是否被分配 */
 #define GET_PREV_ALLOC(bp) (GET(HDRP(bp)) & 0x2)
 /* 设置下一个块header的倒数第二位，如果当前块已分配则为1，如果当前块空闲则为0 */
+#ifndef MM_THREADS
 #define SET_NEXT_ALLOC(bp) (GET(HDRP(NEXT_BLKP(bp))) |= 0x2)
 #define SET_NEXT_FREE(bp)  (GET(HDRP(NEXT_BLKP(bp))) &= (~0x2))
+#else
+/* 线程安全的版本中，下一个块的主人可能正在锁之外读取它的header（见free），因此用原子操作修改 */
+#define SET_NEXT_ALLOC(bp) (__atomic_fetch_or((unsigned int *)HDRP(NEXT_BLKP(bp)), 0x2u, __ATOMIC_RELAXED))
+#define SET_NEXT_FREE(bp)  (__atomic_fetch_and((unsigned int *)HDRP(NEXT_BLKP(bp)), ~0x2u, __ATOMIC_RELAXED))
+#endif
 /* 在不改变倒数第二位的情况下，改变其他的位与val相同，R_PUT的R取Robust之意 */
 #define R_PUT(p,val) (*(unsigned int *)(p) = ((GET(p) & 0x2) | val))
 
@@ -168,19 +416,180 @@
 
 
 
+/* 线程安全的版本中，每个线程使用自己arena的表头 */
+#ifdef MM_THREADS
+#define MM_TLS __thread
+#else
+#define MM_TLS
+#endif
+
+/* mm_stats在热路径上维护的计数器，线程安全的版本中每个arena一份，持有该arena的锁时修改 */
+struct counters {
+    unsigned long extend_heap;      /* extend_heap的次数 */
+    unsigned long coalesce[4];      /* coalesce四种情况各自的次数 */
+    unsigned long fit_searches;     /* find_fit的次数 */
+    unsigned long fit_probes;       /* find_fit查看的空闲块数 */
+    unsigned long realloc_inplace;  /* 原地完成的realloc */
+    unsigned long realloc_copy;     /* 需要复制的realloc */
+    unsigned long blocks;           /* 堆中块的个数，分割时加一、合并时减一 */
+    size_t list_bytes[LISTNUM];     /* 每个链表中空闲块的字节数，insert_list、delete_list时修改 */
+    unsigned long list_blocks[LISTNUM]; /* 每个链表中空闲块的个数 */
+    unsigned long seed_rounded;     /* 预置规则取整的块数，见11 */
+    unsigned long seed_between;     /* malloc直接请求的、介于预置规则的范围与目标之间的块数 */
+    unsigned long seed_off;         /* 预置规则已停用 */
+};
+#ifndef MM_THREADS
+#define STAT(field)  (counters.field)
+#else
+#define STAT(field)  (cur_arena->counters.field)
+#endif
+
+/* 延迟合并的快速链表，同counters，线程安全的版本中每个arena一份 */
+#define QUICK_NUM    (QUICK_MAX / DSIZE - 1)  /* 快速链表的个数，块大小16,24,...,QUICK_MAX各一个 */
+#define QUICK_IDX(s) ((s) / DSIZE - 2)        /* 大小为s的块所在的快速链表 */
+struct quick {
+    void *head[QUICK_NUM];          /* 每个快速链表的栈顶，链接指针位于有效载荷的第一个字 */
+    size_t bytes;                   /* 快速链表中块的总字节数，按所在的类计 */
+    unsigned long count[QUICK_NUM]; /* 每个快速链表中的块数 */
+};
+#ifndef MM_THREADS
+#define QUICK(field) (quick.field)
+#else
+#define QUICK(field) (cur_arena->quick.field)
+#endif
+#define QUICK_PENDING(bp) (SUCC(bp) == (void *)(bp)) /* quick_flush中尚未处理的空闲块 */
+
+/* release_block最近一次释放的整页[lo,hi)，此后没有被写过，同counters，线程安全的版本中每个arena一份 */
+struct released {
+    char *lo;
+    char *hi;
+};
+#ifndef MM_THREADS
+#define RELEASED(field) (released.field)
+#else
+#define RELEASED(field) (cur_arena->released.field)
+#endif
+/* 即将写入[a,b)，a不高于已释放的部分时，已释放的只剩b之后的整页 */
+#define RELEASE_TOUCH(a, b) do { \
+    if (((char *)(b) > RELEASED(lo)) && ((char *)(a) < RELEASED(hi))) \
+        RELEASED(lo) = MIN(RELEASED(hi), (char *)PAGE_UP(PTR_VALUE(b))); \
+} while (0)
+
+/* 计时的版本 */
+#ifdef MM_LATENCY
+#define LAT_LONG_SCAN  16                   /* 查看超过该数目的块视为慢路径 */
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LAT_NOW()      (__rdtsc())
+#else
+#include <time.h>
+static unsigned long lat_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+#define LAT_NOW()      (lat_now())
+#endif
+/* 当前调用经过的慢路径 */
+#define LAT_TAG(tag)   (lat_tags |= 1u << (tag))
+#define LAT_SCAN(n, tag) do { if ((n) > LAT_LONG_SCAN) LAT_TAG(tag); } while (0)
+#else
+#define LAT_TAG(tag)   ((void)0)
+#define LAT_SCAN(n, tag) ((void)(n))
+#endif
+
 /* Global variables */
 static char *heap_listp = 0;  /* Pointer to first block */ 
-static char *seg_list = 0;   /* 指向第一个链表的头结点处 */ 
+static MM_TLS char *seg_list = 0;   /* 指向第一个链表的头结点处 */ 
+static unsigned char *slab_map = 0;  /* 每页是否为run，位于堆之外 */
+static size_t mmap_threshold = MMAP_THRESHOLD; /* 线程安全的版本中在锁之外读写，均为原子操作 */
+static size_t trim_threshold = TRIM_THRESHOLD; /* 同上 */
+static size_t realloc_growth = REALLOC_GROWTH; /* 同上 */
+static size_t chunk_size = CHUNKSIZE;          /* 同上 */
+static size_t split_min = SPLIT_MIN;           /* 同上 */
+static size_t quick_limit = QUICK_LIMIT;       /* 同上 */
+static size_t cache_align = CACHE_ALIGN;       /* 同上 */
+static size_t slab_limit = SLAB_LIMIT;         /* 同上 */
+static unsigned long reserve_hits = 0;         /* 块内预留满足realloc的次数 */
+static char *check_cursor = 0;                 /* mm_check_step下一次检查的块，NULL表示从堆的开头开始 */
+static unsigned long check_interval = 0;       /* 每多少次调用自动检查一次，0表示不检查 */
+static unsigned long check_slice = CHECK_SLICE; /* 每次自动检查的块数 */
+static MM_TLS unsigned long check_countdown = 0; /* 减到0时自动检查 */
+static size_t mmapped_bytes = 0;               /* 映射的块的总长度，线程安全的版本中在锁之外原子地修改 */
+#ifndef MM_THREADS
+static struct counters counters;
+static struct quick quick;
+static struct released released;
+#endif
+static char *zero_brk = 0;                     /* mem_sbrk曾经到达的最高地址，mm_init时不重置 */
+static MM_TLS void *zero_placed = 0;           /* place最近一次从已知为0的块中分配的块 */
+#ifdef MM_LATENCY
+static unsigned long lat_sample = LAT_SAMPLE;  /* 抽样间隔，0表示不抽样 */
+static MM_TLS unsigned long lat_countdown = 0; /* 减到0时计时下一次调用 */
+static MM_TLS unsigned int lat_tags = 0;       /* 计时中的调用经过的慢路径 */
+/* 前MM_LAT_OPS个直方图对应各操作，其后MM_LAT_TAGS个对应各慢路径，第b格为耗时位于[2^b,2^(b+1))个周期的次数 */
+static unsigned long lat_hist[MM_LAT_OPS + MM_LAT_TAGS][MM_LAT_BUCKETS];
+#endif
 
 
 /* Function prototypes for internal helper routines */
 static void *extend_heap(size_t words);  
+static void *heap_malloc(size_t size); /* 以下三个函数操作共享的堆，线程安全的版本中须持有当前arena的锁 */
+static void heap_free(void *bp);
+static void *heap_realloc(void *oldptr, size_t size);
+static void *alloc_block(size_t asize); /* 分配一个大小为asize的块 */
+static void *alloc_aligned(size_t align, size_t asize); /* 分配一个大小为asize、有效载荷按align对齐的块 */
+static void *aligned_fit(size_t align, size_t asize); /* 找到或扩展出一个能放下对齐的块的空闲块 */
+static void *quick_pop(size_t asize); /* 从快速链表中取出一个大小为asize的块 */
+static void quick_push(void *bp, size_t asize, size_t limit); /* 把块bp放入大小为asize的快速链表 */
+#ifdef MM_SIZED_CHECK
+static int sized_ok(void *bp, size_t size); /* mm_free_sized给出的大小是否与块相符 */
+#endif
+static size_t heap_malloc_batch(size_t size, size_t n, void **out); /* 以下两个函数同heap_malloc，批量分配 */
+static void carve(char *bp, size_t asize, size_t k, void **out);
+static int ptr_cmp(const void *a, const void *b);
+static void *heap_memalign(size_t align, size_t size); /* 同heap_malloc，有效载荷按align对齐 */
+static void quick_flush(void); /* 合并快速链表中所有的块 */
+static void quick_flush_all(void); /* 同上，线程安全的版本中依次处理每个arena，须持有所有的锁 */
+static void seed_vote(size_t size); /* malloc的请求是否反对预置的取整规则 */
+static void *slab_alloc(int c); /* 从第c类slab中分配一个槽 */
+static void slab_free(void *bp);
+static void run_unlink(int c, char *r); /* 将run r从第c类的链表中删除 */
+static void *mmap_alloc(size_t size); /* 为size字节的请求建立一段映射 */
+static void *mmap_realloc(void *oldptr, size_t size);
+static int release_block(void *bp, size_t pad); /* 释放空闲块bp内部的整页，开头保留pad字节 */
+static void check_heap(int lineno);
+static int check_lists(int lineno); /* 检查seg_list指向的所有链表 */
+static int check_block(void *bp); /* 增量检查中检查一个块 */
+static void config_env(void); /* 读取环境变量中的策略 */
+static void check_tick(void);
+static void counters_sum(struct counters *sum); /* 合计所有arena的计数器 */
+static void quick_sum(struct quick *sum); /* 合计所有arena的快速链表的字节数和块数 */
+#ifdef MM_THREADS
+static void *tc_malloc(int c); /* 线程缓存的快速路径 */
+static void tc_free(void *bp, int c);
+static void tc_flush(int c, unsigned int n); /* 将第c类缓存中的n个块归还给堆 */
+static void arena_setup(void);
+static struct arena *arena_get(void); /* 当前线程所属的arena */
+static void arena_lock(struct arena *a);
+static void arena_unlock(struct arena *a);
+static void arena_free(void *bp); /* 在持有当前arena的锁时释放任意arena的块 */
+static void remote_push(struct arena *a, void *bp);
+static void *new_segment(size_t size);
+static void claim_granules(char *lo, char *hi);
+static void lock_all(void); /* 依次获取所有arena的锁以及sbrk_lock */
+static void unlock_all(void);
+#endif
 static void place(void *bp, size_t asize);
+static int split_tail(void *bp, size_t asize, unsigned int zero); /* 已分配块bp缩小为asize，多余的部分分割成空闲块 */
 static void *find_fit(size_t asize);
 static void *coalesce(void *bp);
-static int list_idx(size_t size); /* 给定大小size,返回size对应链表的index,范围为0~9 */
+static int list_idx(size_t size); /* 给定大小size,返回size对应链表的index,范围为0~LISTNUM-1 */
 static int insert_list(void *bp); /* 向对应链表中插入块bp */
 static int delete_list(void *bp); /* 从对应链表删除块bp */
+static void tree_insert(char *slot, void *bp); /* 向根位于slot的treap插入块bp */
+static int tree_delete(char *slot, void *bp); /* 从根位于slot的treap删除块bp */
+static void *tree_fit(char *slot, size_t asize); /* 在treap中寻找大小不小于asize的最小块 */
 
 
 /* single word (4) or double word (8) alignment */
@@ -189,13 +598,88 @@ static int delete_list(void *bp); /* 从对应链表删除块bp */
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
 
+/* 请求size个字节时块的大小：已分配块不需要footer，只需加上header，且不小于最小块 */
+#define ADJUST_SIZE(size) (((size) <= DSIZE) ? (2*DSIZE) : (DSIZE * (((size) + WSIZE + (DSIZE-1)) / DSIZE)))
+/* 独占缓存行的块的大小：有效载荷从行首开始，块占整数个行 */
+#define LINE_SIZE(size) ((ADJUST_SIZE(size) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+
+/* 块bp中第一个按align对齐的有效载荷：对齐点之前的部分要么为空，要么能构成一个最小的空闲块 */
+#define ALIGN_UP(v, align)  (((v) + (align) - 1) & ~((unsigned long)(align) - 1))
+#define ALIGN_IN(bp, align) ((char *)(ALIGN_UP(PTR_VALUE(bp), align) + \
+        ((ALIGN_UP(PTR_VALUE(bp), align) - PTR_VALUE(bp) - 1 < 2*DSIZE - 1) ? (align) : 0)))
+#define ALIGN_PROBES 32 /* aligned_fit在链表中查看的块数的上限 */
+
+
+
+#ifdef MM_THREADS
+
+/* 线程安全的版本 */
+
+/* arena，个数MM_ARENAS见mm_config.h */
+#define GRAN_BITS  16
+#define GRAN       (1UL << GRAN_BITS)      /* arena占有堆的粒度，64KB */
+#define GRAN_UP(p) ((PTR_VALUE(p) + GRAN - 1) & ~(GRAN - 1))
+/* 块bp所属的arena：与PUT_PTR相同，地址的低32位即是相对堆起点的偏移 */
+#define ARENA_OF(bp) (&arenas[arena_of[(unsigned int)PTR_VALUE(bp) >> GRAN_BITS]])
+
+struct arena {
+    pthread_mutex_t lock;        /* 保护该arena的链表以及其中所有的块 */
+    char *heads;                 /* 该arena的表头，持锁时seg_list取该值 */
+    void *remote;                /* 其他线程释放的该arena的块组成的栈 */
+    unsigned long map_heads[(PREFIX_WORDS * WSIZE + DSIZE - 1) / DSIZE]; /* arena 1~MM_ARENAS-1的位图与表头 */
+    struct counters counters;    /* 该arena的统计计数器 */
+    struct quick quick;          /* 该arena的快速链表 */
+    struct released released;    /* 该arena最近一次释放的整页 */
+};
+
+static struct arena arenas[MM_ARENAS];
+static unsigned char arena_of[1UL << (32 - GRAN_BITS)]; /* 每个粒度所属的arena */
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;  /* 保护mem_sbrk、arena_of以及top_arena */
+static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;  /* 保护首次使用时的mm_init */
+static struct arena *top_arena;          /* 堆顶的段所属的arena */
+static int heap_ready = 0;               /* mm_init完成后为1 */
+static unsigned int next_arena = 0;      /* 轮转分配arena */
+static __thread struct arena *my_arena;  /* 当前线程所属的arena */
+static __thread struct arena *cur_arena; /* 当前线程持有锁的arena */
+
+/* 线程缓存 */
+#define TC_MAX     256                     /* 不超过TC_MAX的块进入线程缓存 */
+#define TC_NUM     (TC_MAX / DSIZE - 1)    /* 缓存的类数，块大小16,24,...,TC_MAX各一类 */
+#define TC_IDX(s)  ((s) / DSIZE - 2)       /* 大小为s的块所在的类 */
+#define TC_SLAB(c) (TC_NUM + (c))          /* 第c类slab的槽所在的类，排在块之后 */
+#define TC_CLASSES (TC_NUM + SLAB_NUM)
+/* 从堆中取出一个第c类的块或槽 */
+#define TC_ALLOC(c) (((c) < TC_NUM) ? alloc_block(((c) + 2) * DSIZE) : slab_alloc((c) - TC_NUM))
+#define TC_FILL    8                       /* 缓存为空时一次从堆中取出的块数 */
+#define TC_LIMIT   32                      /* 一类缓存的块数超过TC_LIMIT时归还一半 */
+/* 缓存以及remote栈中的块用有效载荷的前8个字节链接成栈 */
+#define TC_NEXT(bp) (*(void **)(bp))
+
+struct tcache {
+    void *head[TC_CLASSES];          /* 每一类的栈顶 */
+    unsigned int count[TC_CLASSES];  /* 每一类缓存的块数 */
+    unsigned long gen;           /* 缓存所属的堆，与heap_gen不同时说明堆已被mm_init重置 */
+};
+
+static __thread struct tcache tcache;
+static unsigned long heap_gen = 0;     /* 每次mm_init加一 */
+static pthread_key_t tc_key;           /* 用于在线程退出时归还缓存 */
+static pthread_once_t tc_once = PTHREAD_ONCE_INIT;
+/* 在锁之外读取heap_gen */
+#define HEAP_GEN()  (__atomic_load_n(&heap_gen, __ATOMIC_RELAXED))
+
+#endif /* def MM_THREADS */
+
 
 
 /*
  * Initialize: return -1 on error, 0 on success.
  * Reset all the global pointers.
  * segragate lists:[1,32),[32,64),[64,128),[128,256),[256,512),[512,1024),[1024,2048),
- * [2048,4096),[4096,8192),[8192,+INF)10 lists
+ * [2048,4096),[4096,8192),[8192,+INF)10 lists by default, see mm_config.h
+ * (with SUBLIST_BITS > 0 every range below 8192 is split further, LISTNUM lists in all)
+ * The environment overrides of the tunables are applied here.
  */
 int mm_init(void) {
 
@@ -204,44 +688,80 @@ int mm_init(void) {
     /* Reset the global pointers */
     heap_listp = NULL;
     seg_list = NULL;
+    __atomic_store_n(&check_cursor, NULL, __ATOMIC_RELAXED);
+#ifdef MM_THREADS
+    /* 调用mm_init时不应有其他线程正在使用堆 */
+    __atomic_store_n(&heap_ready, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&heap_gen, 1, __ATOMIC_RELAXED); /* 各线程的缓存随之作废 */
+    pthread_once(&arena_once, arena_setup);
+    memset(arena_of, 0, sizeof(arena_of));
+    for(int i = 0;i < MM_ARENAS;++i){
+        memset(arenas[i].map_heads, 0, sizeof(arenas[i].map_heads));
+        memset(&arenas[i].counters, 0, sizeof(arenas[i].counters));
+        memset(&arenas[i].quick, 0, sizeof(arenas[i].quick));
+        memset(&arenas[i].released, 0, sizeof(arenas[i].released));
+        arenas[i].heads = (char *)arenas[i].map_heads + DSIZE;
+        arenas[i].remote = NULL;
+    }
+    top_arena = cur_arena = &arenas[0];
+#else
+    memset(&counters, 0, sizeof(counters));
+    memset(&quick, 0, sizeof(quick));
+    memset(&released, 0, sizeof(released));
+#endif
+
+    /* slab_map随堆一起清空：run都在zero_brk之下，只需清零对应的部分，其余的从未写过 */
+    if (slab_map == NULL) {
+        slab_map = mmap(NULL, SLAB_MAP_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (slab_map == MAP_FAILED) {
+            slab_map = NULL;
+            return -1;
+        }
+    } else if (zero_brk != NULL) {
+        memset(slab_map, 0, (PTR_VALUE(zero_brk) - MEM_HEAP_BASE + PAGE - 1) / PAGE);
+    }
 
     /* Create the initial empty heap */
-    if ((heap_listp = mem_sbrk((LISTNUM + 4)*WSIZE)) == (void *)-1) 
+    if ((heap_listp = mem_sbrk(HEAP_OVERHEAD)) == (void *)-1) 
         return -1;
+    zero_brk = MAX(zero_brk, heap_listp + HEAP_OVERHEAD);
 
-    PUT(heap_listp, 0);                          /* Alignment padding */
-
-    /* initialize the segregated list, 12 list head pointers in all */
-    for(int i = 1;i <= LISTNUM;++i){
+    /* initialize the bitmap, the segregated list heads and the slab heads, all lists are empty */
+    for(int i = 0;i < PREFIX_WORDS;++i){
         PUT(heap_listp + (i*WSIZE), 0);
     }
-    PUT(heap_listp + (LISTNUM + 1)*WSIZE, PACK(DSIZE, 1)); /* Prologue header */ 
-    PUT(heap_listp + (LISTNUM + 2)*WSIZE, PACK(DSIZE, 1)); /* Prologue footer */ 
-    PUT(heap_listp + (LISTNUM + 3)*WSIZE, PACK(0, 1));     /* Epilogue header */
-    seg_list = (heap_listp + WSIZE); /*the start of free block list arrays */
-    heap_listp += ((LISTNUM + 2) * WSIZE);  /*the block pointer of Prologue block */
+    PUT(heap_listp + (PREFIX_WORDS)*WSIZE, PACK(DSIZE, 1));     /* Prologue header */ 
+    PUT(heap_listp + (PREFIX_WORDS + 1)*WSIZE, PACK(DSIZE, 1)); /* Prologue footer */ 
+    PUT(heap_listp + (PREFIX_WORDS + 2)*WSIZE, PACK(0, 1));     /* Epilogue header */
+    seg_list = (heap_listp + MAP_WORDS*WSIZE); /*the start of free block list arrays */
+    heap_listp += ((PREFIX_WORDS + 1) * WSIZE);  /*the block pointer of Prologue block */
     SET_NEXT_ALLOC(heap_listp); 
+#ifdef MM_THREADS
+    arenas[0].heads = seg_list; /* arena 0的表头位于堆的开头 */
+#endif
+
+    config_env();
 
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL) {
+    /* Extend the empty heap with a free block of chunk_size bytes */
+    if (extend_heap(CHUNK()/WSIZE) == NULL) {
         return -1;
     }
 
+#ifdef MM_THREADS
+    __atomic_store_n(&heap_ready, 1, __ATOMIC_RELEASE);
+#endif
     return 0;
 }
 
 
 /*
- * malloc - Ask for a block
+ * heap_malloc - Ask for a block from the shared heap
  */
-void *malloc (size_t size) {
+static void *heap_malloc (size_t size) {
 
     //printf("malloc to size %u called\n",size);
 
-    size_t asize;      /* Adjusted block size */
-    size_t extendsize; /* Amount to extend heap if no fit */
-    char *bp;      
-
     if (heap_listp == NULL){
         mm_init();
     }
@@ -249,19 +769,58 @@ void *malloc (size_t size) {
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
+
+    /* 小块独占缓存行，不与其他块（尤其是其他线程的块）共享；对齐点前后多余的部分由alloc_aligned分割为空闲块 */
+    if (size <= __atomic_load_n(&cache_align, __ATOMIC_RELAXED))
+        return alloc_aligned(CACHE_LINE, LINE_SIZE(size));
+
+    if (size <= __atomic_load_n(&slab_limit, __ATOMIC_RELAXED))
+        return slab_alloc(SLAB_IDX(size));
+
+    /* 大块直接映射，失败时仍从堆中分配 */
+    size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    if ((threshold != 0) && (size >= threshold)) {
+        void *bp = mmap_alloc(size);
+        if (bp != NULL)
+            return bp;
+    }
     
-    /* 特定优化 */
-    if ((size >= 439) && (size <= 451)){
-        size = 512;
+    /* Adjust block size to include header,footer and pointers*/
+    size_t asize = ADJUST_SIZE(size);
+    if ((asize >= SEED_FROM) && (asize <= SEED_LAST) && !STAT(seed_off)) {
+        STAT(seed_rounded)++;
+        asize = SEED_TO;
+    }
+    if (asize <= QUICK_MAX) {
+        void *bp = quick_pop(asize);
+        if (bp != NULL)
+            return bp;
     }
+    return alloc_block(asize);
+}
 
-    /* Adjust block size to include header,footer and pointers*/
-    if (size <= DSIZE)                                          
-        asize = 2*DSIZE;                                        
-    else
-        asize = DSIZE * ((size + WSIZE + (DSIZE-1)) / DSIZE); 
-        /* 已分配块不需要footer，所以只需要加上header的大小，即一个WSIZE */
+/*
+ * seed_vote - malloc asks for size bytes; count it against the preset rule if it falls
+ *             between the range of the rule and its target, and switch the rule off
+ *             once such requests outnumber 1/SEED_GATE of the blocks it rounded
+ */
+static void seed_vote(size_t size) {
+    size_t asize = ADJUST_SIZE(size);
+
+    if ((asize > SEED_LAST) && (asize < SEED_TO) && !STAT(seed_off)) {
+        if (++STAT(seed_between) * SEED_GATE > STAT(seed_rounded)) {
+            STAT(seed_off) = 1;
+        }
+    }
+}
+
+/*
+ * alloc_block - Find or make a free block of at least asize bytes and allocate it
+ */
+static void *alloc_block(size_t asize) {
 
+    size_t extendsize; /* Amount to extend heap if no fit */
+    char *bp;      
 
     /* Search the free list for a fit */
     if ((bp = find_fit(asize)) != NULL) {  
@@ -269,8 +828,25 @@ void *malloc (size_t size) {
         return bp;
     }
 
+    /* 快速链表中的块合并后可能满足要求 */
+    if (QUICK(bytes) != 0) {
+        quick_flush();
+        if ((bp = find_fit(asize)) != NULL) {
+            place(bp, asize);
+            return bp;
+        }
+    }
+
     /* No fit found. Get more memory and place the block */
-    extendsize = MAX(asize,CHUNKSIZE);                 
+    extendsize = MAX(asize,CHUNK());
+#ifndef MM_THREADS
+    /* 堆顶的空闲块会与扩展的部分合并，只扩展它不够的部分，否则多出的零头留在块后，
+       之后的小请求放在其中，块再扩大时就只能搬走（线程安全的版本中堆顶可能属于其他arena） */
+    char *top = (char *)mem_heap_hi() + 1;
+    if (!GET_PREV_ALLOC(top) && (GET_SIZE(HDRP(PREV_BLKP(top))) < asize)) {
+        extendsize = MAX(asize - GET_SIZE(HDRP(PREV_BLKP(top))), CHUNK());
+    }
+#endif
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL)  
         return NULL;                                  
     place(bp, asize); 
@@ -278,133 +854,1952 @@ void *malloc (size_t size) {
 }
 
 /*
- * free - Free a block
- * 
+ * aligned_fit - Find a free block that holds a block of asize bytes whose payload is aligned to align,
+ *               or extend the heap so that its top free block does; return NULL if the heap cannot grow
+ *               先在链表中查看至多ALIGN_PROBES个块，对齐点位于块内即可，不必多出align字节；
+ *               再退回到一定放得下的asize+align+2*DSIZE字节的块；扩展堆时只扩展到堆顶恰好放得下
  */
-void free (void *bp) {
+static void *aligned_fit(size_t align, size_t asize) {
+    int idx = list_idx(asize);
+    unsigned long map = LIST_MAP & (~0UL << idx);
+    unsigned long probes = 0;
+    char *bp;
 
-    if (bp == NULL) 
-        return;
-        
+    STAT(fit_searches)++;
+    while ((map != 0) && (probes < ALIGN_PROBES)) {
+        idx = __builtin_ctzl(map);
+        map &= map - 1;
+        if (idx >= TREE_LIST)
+            break; /* treap中的块都足够大，由下面的find_fit取最小的一个 */
+        for (bp = (char *)GET_PTR(seg_list + idx * WSIZE); (bp != NULL) && (probes < ALIGN_PROBES); bp = (char *)SUCC(bp)) {
+            probes++;
+            if (ALIGN_IN(bp, align) + asize <= bp + GET_SIZE(HDRP(bp))) {
+                STAT(fit_probes) += probes;
+                return bp;
+            }
+        }
+    }
+    STAT(fit_probes) += probes;
 
-    size_t size = GET_SIZE(HDRP(bp));
-    if (heap_listp == 0){
-        mm_init();
+    if ((bp = find_fit(asize + align + 2*DSIZE)) != NULL)
+        return bp;
+    if (QUICK(bytes) != 0) {
+        quick_flush();
+        if ((bp = find_fit(asize + align + 2*DSIZE)) != NULL)
+            return bp;
     }
 
-    /* The second bit should be saved */
-    R_PUT(HDRP(bp), PACK(size, 0));
-    R_PUT(FTRP(bp), PACK(size, 0));
-    SET_NEXT_FREE(bp); 
+#ifndef MM_THREADS
+    /* 堆顶的空闲块（若有）连同扩展的部分恰好放得下；结尾块的header记录了前一个块是否空闲 */
+    char *top = (char *)mem_heap_hi() + 1;
+    char *start = GET_PREV_ALLOC(top) ? top : (char *)PREV_BLKP(top);
+    size_t need;
 
-    SET_PRED(bp,NULL);
-    SET_SUCC(bp,NULL);
+    if (ALIGN_IN(start, align) + asize <= top)
+        return start; /* 查看的块数达到上限时可能没有看到它 */
+    need = ALIGN_IN(start, align) + asize - top;
+    return extend_heap(MAX(need, CHUNK()) / WSIZE);
+#else
+    /* 堆顶可能属于其他arena，扩展出的块不一定接在堆顶的空闲块之后 */
+    size_t extendsize = MAX(asize + align + 2*DSIZE, CHUNK());
+    return extend_heap(extendsize / WSIZE);
+#endif
+}
 
-    coalesce(bp);
+/*
+ * alloc_aligned - Allocate a block of asize bytes whose payload is aligned to align (a power of 2, at least DSIZE)
+ *                 整个空闲块先分配出去，对齐点之前、之后多余的部分再分割出来成为空闲块
+ */
+static void *alloc_aligned(size_t align, size_t asize) {
+    char *bp, *abp;
+    size_t size, lead;
+
+    if ((bp = aligned_fit(align, asize)) == NULL)
+        return NULL;
+    place(bp, GET_SIZE(HDRP(bp)));
+    abp = ALIGN_IN(bp, align);
+
+    size = GET_SIZE(HDRP(bp));
+    if (abp != bp) {
+        lead = abp - bp;
+        PUT(HDRP(abp), PACK(size - lead, 1));  /* 前一个块（分割出的部分）空闲 */
+        R_PUT(HDRP(bp), PACK(lead, 0));
+        PUT(FTRP(bp), PACK(lead, 0));
+        SET_PRED(bp,NULL);
+        SET_SUCC(bp,NULL);
+        STAT(blocks)++;
+        coalesce(bp);
+        size -= lead;
+    }
+
+    /* 把末尾多余的部分分割出来 */
+    split_tail(abp, asize, 0);
+    return abp;
 }
 
+/*
+ * slab_alloc - Take the first free slot of the first run in class c,
+ *              making a new run if the class has none
+ */
+static void *slab_alloc(int c) {
+    char *r = (char *)GET_PTR(SLAB_HEAD(c));
+    unsigned long *map;
+    unsigned int slot = (c + 1) * DSIZE;
+    int w, i;
+
+    if (r == NULL) {
+        /* 新建一个run：一个有效载荷按页对齐、大小恰好为一页的块，header位于前一页的最后一个字 */
+        if ((r = alloc_aligned(PAGE, PAGE)) == NULL)
+            return NULL;
+        RUN_SLOT(r) = slot;
+        RUN_AVAIL(r) = RUN_SLOTS(slot);
+        SET_RUN_PREV(r, NULL);
+        SET_RUN_NEXT(r, NULL);
+        map = RUN_MAP(r);
+        for (w = 0; w < RUN_MAP_WORDS; ++w) {
+            i = RUN_SLOTS(slot) - 64 * w;
+            map[w] = (i >= 64) ? ~0UL : (i <= 0) ? 0 : ((1UL << i) - 1);
+        }
+        PUT_PTR(SLAB_HEAD(c), r);
+        IS_SLAB(r) = 1;
+    }
+
+    map = RUN_MAP(r);
+    for (w = 0; map[w] == 0; ++w)
+        ;
+    i = 64 * w + __builtin_ctzl(map[w]);
+    map[w] &= map[w] - 1;
+
+    /* 没有空闲槽的run离开链表 */
+    if (--RUN_AVAIL(r) == 0) {
+        run_unlink(c, r);
+    }
+    return r + RUN_HDR + i * slot;
+}
 
+/*
+ * slab_free - Give the slot bp back to its run; a run that becomes empty
+ *             goes back to the heap unless it is the only run of its class
+ */
+static void slab_free(void *bp) {
+    char *r = RUN_OF(bp);
+    unsigned int slot = RUN_SLOT(r);
+    int c = SLAB_IDX(slot);
+    unsigned int i = ((char *)bp - r - RUN_HDR) / slot;
+
+    RUN_MAP(r)[i / 64] |= 1UL << (i % 64);
+
+    if (RUN_AVAIL(r)++ == 0) {
+        /* 原来已满的run重新进入链表 */
+        char *head = (char *)GET_PTR(SLAB_HEAD(c));
+        SET_RUN_PREV(r, NULL);
+        SET_RUN_NEXT(r, head);
+        if (head != NULL) {
+            SET_RUN_PREV(head, r);
+        }
+        PUT_PTR(SLAB_HEAD(c), r);
+    }
 
+    if ((RUN_AVAIL(r) == RUN_SLOTS(slot)) && ((RUN_PREV(r) != NULL) || (RUN_NEXT(r) != NULL))) {
+        run_unlink(c, r);
+        IS_SLAB(r) = 0;
+        heap_free(r);
+    }
+}
 
+/*
+ * run_unlink - Remove run r from the list of class c
+ */
+static void run_unlink(int c, char *r) {
+    char *prev = RUN_PREV(r);
+    char *next = RUN_NEXT(r);
+
+    if (prev == NULL) {
+        PUT_PTR(SLAB_HEAD(c), next);
+    } else {
+        SET_RUN_NEXT(prev, next);
+    }
+    if (next != NULL) {
+        SET_RUN_PREV(next, prev);
+    }
+}
 
 /*
- * realloc - change the size of an allocated block
+ * mmap_alloc - Map a chunk for a request of size bytes;
+ *              return NULL if mmap fails or the chunk lands inside the heap's 4GB window
  */
+static void *mmap_alloc(size_t size) {
+    size_t len = PAGE_UP(size + 2*DSIZE);
+    char *base;
 
+    if (len < size)
+        return NULL;
+    base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (!IS_MMAPPED(base + 2*DSIZE)) {
+        munmap(base, len);
+        return NULL;
+    }
 
-void *realloc(void *oldptr, size_t size) {
-    //printf("realloc to %lx of size %ld called\n",PTR_VALUE(oldptr),size);
-    size_t asize;
-    size_t oldsize;
+    MMAP_LEN(base + 2*DSIZE) = len;
+    PUT(HDRP(base + 2*DSIZE), PACK(0, 1));
+    __atomic_add_fetch(&mmapped_bytes, len, __ATOMIC_RELAXED);
+    return base + 2*DSIZE;
+}
 
-    /* If oldptr is NULL, then this is just malloc. */
-    if(oldptr == NULL) {
-        return malloc(size);
+/*
+ * mmap_realloc - Resize the mapped block oldptr with mremap,
+ *                or move it into the heap if size is now below the threshold
+ */
+static void *mmap_realloc(void *oldptr, size_t size) {
+    size_t oldlen = MMAP_LEN(oldptr);
+    size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    size_t len = PAGE_UP(size + 2*DSIZE);
+    char *base;
+
+    if ((threshold != 0) && (size >= threshold) && (len >= size)) {
+        if (len == oldlen) {
+            STAT(realloc_inplace)++;
+            return oldptr;
+        }
+        base = mremap((char *)oldptr - 2*DSIZE, oldlen, len, MREMAP_MAYMOVE);
+        if (base != MAP_FAILED) {
+            __atomic_add_fetch(&mmapped_bytes, len - oldlen, __ATOMIC_RELAXED);
+        }
+        if ((base != MAP_FAILED) && IS_MMAPPED(base + 2*DSIZE)) {
+            MMAP_LEN(base + 2*DSIZE) = len;
+            STAT(realloc_inplace)++;
+            return base + 2*DSIZE;
+        }
+        if (base != MAP_FAILED) {
+            /* 移到了堆的范围之内（几乎不会发生），改为复制到堆中 */
+            oldptr = base + 2*DSIZE;
+            MMAP_LEN(oldptr) = len;
+            oldlen = len;
+        } else if (len < oldlen) {
+            STAT(realloc_inplace)++;
+            return oldptr;
+        }
     }
+    STAT(realloc_copy)++;
 
-    /* If size == 0 then this is just free, and we return NULL. */
-    if(size == 0) {
-        free(oldptr);
+    void *newptr = heap_malloc(size);
+    if (newptr == NULL)
         return NULL;
+    memcpy(newptr, oldptr, MIN(size, oldlen - 2*DSIZE));
+    munmap((char *)oldptr - 2*DSIZE, oldlen);
+    __atomic_sub_fetch(&mmapped_bytes, oldlen, __ATOMIC_RELAXED);
+    return newptr;
+}
+
+/*
+ * mm_mallopt - Set the tunable param to value; return 1 on success, 0 on error
+ */
+int mm_mallopt(int param, long value) {
+    switch (param) {
+    case MM_MMAP_THRESHOLD:
+        if (value < 0)
+            return 0;
+        __atomic_store_n(&mmap_threshold, (size_t)value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_TRIM_THRESHOLD:
+        if (value < 0)
+            return 0;
+        __atomic_store_n(&trim_threshold, (size_t)value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_REALLOC_GROWTH:
+        if ((value < 0) || (value > 1000))
+            return 0;
+        __atomic_store_n(&realloc_growth, (value > 100) ? (size_t)value : 0, __ATOMIC_RELAXED);
+        return 1;
+    case MM_CHECK_INTERVAL:
+        if (value < 0)
+            return 0;
+        __atomic_store_n(&check_interval, (unsigned long)value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_CHECK_SLICE:
+        if (value <= 0)
+            return 0;
+        __atomic_store_n(&check_slice, (unsigned long)value, __ATOMIC_RELAXED);
+        return 1;
+#ifdef MM_LATENCY
+    case MM_LAT_SAMPLE:
+        if (value < 0)
+            return 0;
+        __atomic_store_n(&lat_sample, (unsigned long)value, __ATOMIC_RELAXED);
+        return 1;
+#endif
+    case MM_CHUNK_SIZE:
+        if ((value < 2*DSIZE) || (value > (1L << 30)))
+            return 0;
+        __atomic_store_n(&chunk_size, (size_t)ALIGN(value), __ATOMIC_RELAXED);
+        return 1;
+    case MM_SPLIT_MIN:
+        if (value < 2*DSIZE)
+            return 0;
+        __atomic_store_n(&split_min, (size_t)ALIGN(value), __ATOMIC_RELAXED);
+        return 1;
+    case MM_QUICK_LIMIT:
+        if ((value < 0) || (value > (1L << 30)))
+            return 0;
+        __atomic_store_n(&quick_limit, (size_t)value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_CACHE_ALIGN:
+        if ((value < 0) || (value > PAGE))
+            return 0;
+        __atomic_store_n(&cache_align, (size_t)value, __ATOMIC_RELAXED);
+        return 1;
+    case MM_SLAB_LIMIT:
+        if ((value < 0) || (value > SLAB_MAX))
+            return 0;
+        __atomic_store_n(&slab_limit, (size_t)value, __ATOMIC_RELAXED);
+        return 1;
+    default:
+        return 0;
     }
+}
 
+/*
+ * config_env - Apply the tunables set in the environment, as if by mm_mallopt;
+ *              values that do not parse or that mm_mallopt rejects are ignored
+ */
+static void config_env(void) {
+    static const struct {
+        const char *name;
+        int param;
+    } env[] = {
+        { "MM_CHUNK_SIZE",     MM_CHUNK_SIZE },
+        { "MM_SPLIT_MIN",      MM_SPLIT_MIN },
+        { "MM_MMAP_THRESHOLD", MM_MMAP_THRESHOLD },
+        { "MM_TRIM_THRESHOLD", MM_TRIM_THRESHOLD },
+        { "MM_REALLOC_GROWTH", MM_REALLOC_GROWTH },
+        { "MM_CHECK_INTERVAL", MM_CHECK_INTERVAL },
+        { "MM_CHECK_SLICE",    MM_CHECK_SLICE },
+        { "MM_LAT_SAMPLE",     MM_LAT_SAMPLE },
+        { "MM_QUICK_LIMIT",    MM_QUICK_LIMIT },
+        { "MM_CACHE_ALIGN",    MM_CACHE_ALIGN },
+        { "MM_SLAB_LIMIT",     MM_SLAB_LIMIT },
+    };
+
+    for (size_t i = 0; i < sizeof(env) / sizeof(env[0]); ++i) {
+        const char *s = getenv(env[i].name);
+        char *end;
+        long value;
+
+        if ((s == NULL) || (*s == '\0'))
+            continue;
+        value = strtol(s, &end, 0);
+        if (*end == '\0') {
+            mm_mallopt(env[i].param, value);
+        }
+    }
+}
 
-    oldsize = GET_SIZE(HDRP(oldptr));
+/*
+ * release_block - Give the whole pages inside the free block bp back to the system,
+ *                 keeping the first pad bytes of its payload;
+ *                 return 1 if any page was released, 0 otherwise
+ */
+static int release_block(void *bp, size_t pad) {
+    /* 前驱、后继（或左右孩子）以及footer不能丢失 */
+    char *lo = (char *)PAGE_UP(PTR_VALUE(bp) + DSIZE + pad);
+    char *hi = (char *)(PTR_VALUE(FTRP(bp)) & ~(PAGE - 1));
+    char *a = MIN(hi, RELEASED(lo));
+    char *b = MAX(lo, RELEASED(hi));
+
+    /* 已知为0的块内部的整页要么从未被写过，要么已经释放过 */
+    if ((hi <= lo) || (PTR_VALUE(lo) < PTR_VALUE(bp)) || GET_ZERO(bp)) 
+        return 0;
+    /* 上一次释放的[RELEASED(lo),RELEASED(hi))之后没有被写过，只释放其两侧的页 */
+    if ((lo >= a) && (b >= hi))
+        return 0;
+    if (lo < a)
+        madvise(lo, a - lo, MADV_DONTNEED);
+    if (b < hi)
+        madvise(b, hi - b, MADV_DONTNEED);
+    RELEASED(lo) = lo;
+    RELEASED(hi) = hi;
+
+    /* 释放的页再次访问时为0，把两端剩余的部分也清零，整个块就已知为0 */
+    if ((pad == 0) && !GET_ZERO(bp)) {
+        memset((char *)bp + DSIZE, 0, lo - ((char *)bp + DSIZE));
+        memset(hi, 0, (char *)FTRP(bp) - hi);
+        PUT(HDRP(bp), GET(HDRP(bp)) | ZERO_BIT);
+        PUT(FTRP(bp), GET(FTRP(bp)) | ZERO_BIT);
+    }
+    return 1;
+}
 
-    if(size <= DSIZE){
-        asize = 2*DSIZE;
-    }else{
-        asize = DSIZE * ((size + WSIZE + (DSIZE-1))/DSIZE);
-        /* 同malloc，可以少申请一个WSIZE */
+/*
+ * mm_trim - Release the whole pages of every free block to the system,
+ *           keeping pad bytes at the start of the block at the top of the heap;
+ *           return 1 if any memory was released, 0 otherwise
+ */
+int mm_trim(size_t pad) {
+    int released = 0;
+
+#ifdef MM_THREADS
+    arena_get();
+    lock_all();
+#endif
+    quick_flush_all();
+    if (heap_listp != NULL) {
+        for (char *bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+            if (!GET_ALLOC(HDRP(bp))) {
+                released |= release_block(bp, (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0) ? pad : 0);
+            }
+        }
     }
+#ifdef MM_THREADS
+    unlock_all();
+#endif
+    return released;
+}
 
-    if(asize == oldsize){
-        /* new block and old block share the same size, no need to apply for a new block */
-        return oldptr;
-    }else if(asize > oldsize){
-        void * newptr;
+/*
+ * mm_realloc_reserve_hits - Return how many reallocs were served by the reserve of a grown block
+ */
+unsigned long mm_realloc_reserve_hits(void) {
+    return __atomic_load_n(&reserve_hits, __ATOMIC_RELAXED);
+}
 
-        /* new block is larger, call malloc */
-        newptr = malloc(size);
+/*
+ * mm_size_rounding - Store the active rounding rules, at most n of them:
+ *                    block sizes in [from[i], to[i]) are rounded up to to[i];
+ *                    return the number of rules stored
+ *                    只有预置规则，它只取整[SEED_FROM,SEED_LAST]，即439~451字节的请求；停用之后返回0
+ *                    线程安全的版本中给出当前线程所属arena的规则
+ */
+int mm_size_rounding(size_t *from, size_t *to, int n) {
+    int cnt = 0;
 
-        /* If realloc() fails the original block is left untouched  */
-        if(!newptr) {
-            return 0;
+#ifdef MM_THREADS
+    struct arena *a = arena_get();
+    arena_lock(a);
+#endif
+    if (seg_list != NULL) {
+        if (!STAT(seed_off) && (cnt < n)) {
+            from[cnt] = SEED_FROM;
+            to[cnt] = SEED_TO;
+            ++cnt;
         }
-        /*copy the data */
-        if(size < oldsize) oldsize = size;
-        memcpy(newptr, oldptr, oldsize);
+    }
+#ifdef MM_THREADS
+    arena_unlock(a);
+#endif
+    return cnt;
+}
 
-        /* Free the old block. */
-        free(oldptr);
+/*
+ * counters_sum - Add up the counters of every arena into sum
+ */
+static void counters_sum(struct counters *sum) {
+    memset(sum, 0, sizeof(*sum));
+#ifdef MM_THREADS
+    for (int i = 0; i < MM_ARENAS; ++i) {
+        struct counters *c = &arenas[i].counters;
+#else
+    {
+        struct counters *c = &counters;
+#endif
+        sum->extend_heap += c->extend_heap;
+        for (int k = 0; k < 4; ++k) {
+            sum->coalesce[k] += c->coalesce[k];
+        }
+        sum->fit_searches += c->fit_searches;
+        sum->fit_probes += c->fit_probes;
+        sum->realloc_inplace += c->realloc_inplace;
+        sum->realloc_copy += c->realloc_copy;
+        sum->blocks += c->blocks;
+        for (int k = 0; k < LISTNUM; ++k) {
+            sum->list_bytes[k] += c->list_bytes[k];
+            sum->list_blocks[k] += c->list_blocks[k];
+        }
+    }
+}
 
-        return newptr;
+/*
+ * quick_sum - Add up the bytes and the per-class counts of the quick lists of every arena into sum;
+ *             the heads are left NULL
+ */
+static void quick_sum(struct quick *sum) {
+    memset(sum, 0, sizeof(*sum));
+#ifdef MM_THREADS
+    for (int i = 0; i < MM_ARENAS; ++i) {
+        struct quick *q = &arenas[i].quick;
+#else
+    {
+        struct quick *q = &quick;
+#endif
+        sum->bytes += q->bytes;
+        for (int c = 0; c < QUICK_NUM; ++c) {
+            sum->count[c] += q->count[c];
+        }
+    }
+}
 
-    }else{
-        
-        size_t csize = oldsize-asize;
-       
-        
-        if(csize >= 2*DSIZE){
-            /* 新的大小asize小于oldsize，且差值大于一个最小空闲块的大小，
-                需要将oldsize指向的块分割成一个已分配块和一个空闲块，原理类似place函数
-                注意：不能为已分配块设置footer，这样会导致garbled bytes错误*/
-            
-            R_PUT(HDRP(oldptr),PACK(asize,1));
-            /* 不能设置footer */
-            SET_NEXT_ALLOC(oldptr);
+/*
+ * mm_stats - Fill st with the statistics of the heap; return 0
+ *            全部来自热路径上维护的计数器，不遍历堆：空闲的字节数和块数是各链表之和，
+ *            已分配的字节数是堆中除开头的表头、序言块和结尾块之外的其余部分，块数是总块数减去空闲块数
+ *            快速链表中的块不合并（统计不应改变堆），header仍为已分配，单独计为延迟释放，
+ *            从已分配的字节数和块数中减去；字节数按所在的类计，mm_free_sized放入较小的类的块多出的部分仍算已分配
+ *            线程安全的版本中合计所有arena，缓存中的块计入已分配
+ */
+int mm_stats(struct mm_stats *st) {
+    struct counters c;
+    struct quick q;
+
+    memset(st, 0, sizeof(*st));
+    st->lists = LISTNUM;
+
+#ifdef MM_THREADS
+    arena_get();
+    lock_all();
+#endif
+    counters_sum(&c);
+    quick_sum(&q);
+    st->extend_heap = c.extend_heap;
+    for (int k = 0; k < 4; ++k) {
+        st->coalesce[k] = c.coalesce[k];
+    }
+    st->fit_searches = c.fit_searches;
+    st->fit_probes = c.fit_probes;
+    st->realloc_inplace = c.realloc_inplace;
+    st->realloc_copy = c.realloc_copy;
+
+    if (heap_listp != NULL) {
+        st->heap_size = mem_heapsize();
+        for (int k = 0; k < LISTNUM; ++k) {
+            st->list_bytes[k] = c.list_bytes[k];
+            st->list_blocks[k] = c.list_blocks[k];
+            st->free_bytes += c.list_bytes[k];
+            st->free_blocks += c.list_blocks[k];
+        }
+        st->quick_lists = QUICK_NUM;
+        for (int k = 0; k < QUICK_NUM; ++k) {
+            st->quick_blocks[k] = q.count[k];
+            st->deferred_blocks += q.count[k];
+        }
+        st->deferred_bytes = q.bytes;
+        st->in_use = st->heap_size - HEAP_OVERHEAD - st->free_bytes - st->deferred_bytes;
+        st->alloc_blocks = c.blocks - st->free_blocks - st->deferred_blocks;
+    }
+    st->mmapped = __atomic_load_n(&mmapped_bytes, __ATOMIC_RELAXED);
+    st->reserve_hits = __atomic_load_n(&reserve_hits, __ATOMIC_RELAXED);
+#ifdef MM_THREADS
+    unlock_all();
+#endif
+    return 0;
+}
+
+/* 碎片的概要，由frag_scan遍历堆得到 */
+struct frag {
+    size_t heap_size;
+    size_t in_use;
+    size_t free_bytes;
+    size_t largest;                       /* 最大的空闲块 */
+    unsigned long blocks;                 /* 块的总数，不含序言块和结尾块 */
+    unsigned long free_blocks;
+    unsigned long list_blocks[LISTNUM];   /* 每个链表中空闲块的个数、字节数、最小和最大的块 */
+    size_t list_bytes[LISTNUM];
+    size_t list_min[LISTNUM];
+    size_t list_max[LISTNUM];
+    size_t deferred_bytes;                /* 快速链表中的块，header仍为已分配，不计入in_use */
+    unsigned long deferred_blocks;
+    unsigned long quick_blocks[QUICK_NUM];
+};
+
+/*
+ * frag_scan - Walk the heap from the prologue to the epilogue and fill f
+ *             再遍历快速链表，其中的块按header的大小计为延迟释放，从已分配中减去
+ */
+static void frag_scan(struct frag *f) {
+    memset(f, 0, sizeof(*f));
+    if (heap_listp == NULL)
+        return;
+
+    f->heap_size = mem_heapsize();
+    for (char *bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        size_t size = GET_SIZE(HDRP(bp));
+        f->blocks++;
+        if (GET_ALLOC(HDRP(bp))) {
+            f->in_use += size;
+            continue;
+        }
+        int idx = list_idx(size);
+        f->free_blocks++;
+        f->free_bytes += size;
+        f->largest = MAX(f->largest, size);
+        if ((f->list_blocks[idx]++ == 0) || (size < f->list_min[idx])) {
+            f->list_min[idx] = size;
+        }
+        f->list_max[idx] = MAX(f->list_max[idx], size);
+        f->list_bytes[idx] += size;
+    }
+
+#ifdef MM_THREADS
+    struct arena *a = cur_arena;
+    for (int i = 0; i < MM_ARENAS; ++i) {
+        cur_arena = &arenas[i];
+#else
+    {
+#endif
+        for (int c = 0; c < QUICK_NUM; ++c) {
+            for (void *bp = QUICK(head[c]); bp != NULL; bp = GET_PTR(bp)) {
+                f->deferred_bytes += GET_SIZE(HDRP(bp));
+                f->deferred_blocks++;
+                f->quick_blocks[c]++;
+            }
+        }
+    }
+#ifdef MM_THREADS
+    cur_arena = a;
+#endif
+    f->in_use -= f->deferred_bytes;
+}
+
+/*
+ * quick_collect - Return the blocks of every quick list, sorted by address, in an array of
+ *                 f->deferred_blocks pointers mapped with mmap; NULL if there is none or mmap failed
+ */
+static void **quick_collect(const struct frag *f) {
+    size_t len = f->deferred_blocks * sizeof(void *);
+    void **v;
+    unsigned long n = 0;
+
+    if (f->deferred_blocks == 0)
+        return NULL;
+    v = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (v == MAP_FAILED)
+        return NULL;
+
+#ifdef MM_THREADS
+    struct arena *a = cur_arena;
+    for (int i = 0; i < MM_ARENAS; ++i) {
+        cur_arena = &arenas[i];
+#else
+    {
+#endif
+        for (int c = 0; c < QUICK_NUM; ++c) {
+            for (void *bp = QUICK(head[c]); bp != NULL; bp = GET_PTR(bp)) {
+                v[n++] = bp;
+            }
+        }
+    }
+#ifdef MM_THREADS
+    cur_arena = a;
+#endif
+    qsort(v, n, sizeof(void *), ptr_cmp);
+    return v;
+}
+
+/* 外部碎片率：空闲字节中不能用于一次最大的分配的比例 */
+#define EXT_FRAG(f)  ((f)->free_bytes ? 1.0 - (double)(f)->largest / (f)->free_bytes : 0.0)
+
+/* 块所属的arena */
+#ifdef MM_THREADS
+#define ARENA_IDX(bp)  (arena_of[(unsigned int)PTR_VALUE(bp) >> GRAN_BITS])
+#else
+#define ARENA_IDX(bp)  0
+#endif
+
+/* 以小端序写入n字节的整数 */
+static void put_le(FILE *fp, unsigned long v, int n) {
+    for (int i = 0; i < n; ++i) {
+        fputc((int)((v >> (8 * i)) & 0xff), fp);
+    }
+}
+
+/*
+ * mm_snapshot - Write the layout of every block in the heap to fp,
+ *               as JSON (MM_SNAP_JSON) or in the binary format described in mm.h (MM_SNAP_BINARY);
+ *               return 0 on success, -1 on a bad format, a write error or if mmap failed
+ *               快速链表中的块标为MM_SNAP_DEFERRED：按地址排好序，遍历堆时依次对照
+ */
+int mm_snapshot(FILE *fp, int format) {
+    struct frag f;
+    void **deferred;
+    unsigned long next = 0;
+    int ret = 0;
+
+    if ((format != MM_SNAP_JSON) && (format != MM_SNAP_BINARY))
+        return -1;
+
+#ifdef MM_THREADS
+    arena_get();
+    lock_all();
+#endif
+    frag_scan(&f);
+    deferred = quick_collect(&f);
+    if ((deferred == NULL) && (f.deferred_blocks != 0)) {
+#ifdef MM_THREADS
+        unlock_all();
+#endif
+        return -1;
+    }
+
+    if (format == MM_SNAP_JSON) {
+        fprintf(fp, "{\"version\":2,\"heap_lo\":%lu,\"heap_size\":%zu,\"lists\":%d,\n",
+                PTR_VALUE(mem_heap_lo()), f.heap_size, LISTNUM);
+        fprintf(fp, "\"summary\":{\"blocks\":%lu,\"in_use\":%zu,\"free_bytes\":%zu,\"free_blocks\":%lu,"
+                "\"deferred_bytes\":%zu,\"deferred_blocks\":%lu,"
+                "\"largest_free\":%zu,\"external_fragmentation\":%.4f,\"quick_lists\":[",
+                f.blocks, f.in_use, f.free_bytes, f.free_blocks, f.deferred_bytes, f.deferred_blocks,
+                f.largest, EXT_FRAG(&f));
+        /* 每个非空的快速链表为{类的大小,块数} */
+        for (int c = 0, first = 1; c < QUICK_NUM; ++c) {
+            if (f.quick_blocks[c] == 0)
+                continue;
+            fprintf(fp, "%s{\"size\":%d,\"blocks\":%lu}", first ? "" : ",", (c + 2) * DSIZE, f.quick_blocks[c]);
+            first = 0;
+        }
+        fprintf(fp, "],\"free_lists\":[");
+        for (int i = 0, first = 1; i < LISTNUM; ++i) {
+            if (f.list_blocks[i] == 0)
+                continue;
+            fprintf(fp, "%s\n{\"list\":%d,\"blocks\":%lu,\"bytes\":%zu,\"smallest\":%zu,\"largest\":%zu}",
+                    first ? "" : ",", i, f.list_blocks[i], f.list_bytes[i], f.list_min[i], f.list_max[i]);
+            first = 0;
+        }
+        /* 每个块为[偏移,大小,标志,链表,arena]，已分配块的链表为-1 */
+        fprintf(fp, "]},\n\"blocks\":[");
+    } else {
+        fwrite("MMSNAP01", 1, 8, fp);
+        put_le(fp, f.blocks, 4);
+        put_le(fp, LISTNUM, 4);
+        put_le(fp, f.heap_size, 8);
+    }
+
+    if (heap_listp != NULL) {
+        unsigned long n = 0;
+        for (char *bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+            size_t size = GET_SIZE(HDRP(bp));
+            unsigned long off = (char *)HDRP(bp) - (char *)mem_heap_lo();
+            int alloc = GET_ALLOC(HDRP(bp));
+            int flags = alloc ? (MM_SNAP_ALLOC | (IS_SLAB(bp) ? MM_SNAP_SLAB : 0))
+                              : (GET_ZERO(bp) ? MM_SNAP_ZERO : 0);
+            if ((next < f.deferred_blocks) && (deferred[next] == (void *)bp)) {
+                flags |= MM_SNAP_DEFERRED;
+                next++;
+            }
+            int list = alloc ? -1 : list_idx(size);
+
+            if (format == MM_SNAP_JSON) {
+                /* 每行8个块 */
+                fprintf(fp, "%s[%lu,%zu,%d,%d,%d]", (n == 0) ? "" : ((n % 8) ? "," : ",\n"),
+                        off, size, flags, list, ARENA_IDX(bp));
+            } else {
+                put_le(fp, off, 4);
+                put_le(fp, size, 4);
+                put_le(fp, flags, 1);
+                put_le(fp, (list < 0) ? 255 : list, 1);
+                put_le(fp, ARENA_IDX(bp), 2);
+            }
+            n++;
+        }
+    }
+    if (format == MM_SNAP_JSON) {
+        fprintf(fp, "]}\n");
+    }
+    if (fflush(fp) != 0 || ferror(fp))
+        ret = -1;
+    if (deferred != NULL)
+        munmap(deferred, f.deferred_blocks * sizeof(void *));
+
+#ifdef MM_THREADS
+    unlock_all();
+#endif
+    return ret;
+}
+
+/*
+ * mm_fragmentation - Print a summary of the fragmentation of the heap to fp
+ */
+void mm_fragmentation(FILE *fp) {
+    struct frag f;
+
+#ifdef MM_THREADS
+    arena_get();
+    lock_all();
+#endif
+    frag_scan(&f);
+#ifdef MM_THREADS
+    unlock_all();
+#endif
+
+    fprintf(fp, "heap %zu bytes in %lu blocks: %zu in use, %zu free in %lu blocks\n",
+            f.heap_size, f.blocks, f.in_use, f.free_bytes, f.free_blocks);
+    fprintf(fp, "largest free block %zu, external fragmentation %.1f%%\n",
+            f.largest, 100 * EXT_FRAG(&f));
+    if (f.deferred_blocks != 0) {
+        fprintf(fp, "%zu bytes in %lu blocks deferred in the quick lists, counted neither in use nor free\n",
+                f.deferred_bytes, f.deferred_blocks);
+    }
+    fprintf(fp, "%4s %8s %12s %9s %9s\n", "list", "blocks", "bytes", "smallest", "largest");
+    for (int i = 0; i < LISTNUM; ++i) {
+        if (f.list_blocks[i] != 0) {
+            fprintf(fp, "%4d %8lu %12zu %9zu %9zu\n",
+                    i, f.list_blocks[i], f.list_bytes[i], f.list_min[i], f.list_max[i]);
+        }
+    }
+}
+
+/*
+ * quick_pop - Take a block of exactly asize bytes from its quick list; return NULL if there is none
+ */
+static void *quick_pop(size_t asize) {
+    void **head = &QUICK(head[QUICK_IDX(asize)]);
+    void *bp = *head;
+
+    if (bp != NULL) {
+        *head = GET_PTR(bp);
+        QUICK(bytes) -= asize;
+        QUICK(count[QUICK_IDX(asize)])--;
+        PUT(HDRP(bp), GET(HDRP(bp)) & ~0x4); /* 清除realloc留下的GROWN位 */
+    }
+    return bp;
+}
+
+/*
+ * quick_push - Push the allocated block bp onto the quick list of asize bytes,
+ *              coalescing every quick list once they hold more than limit bytes
+ *              mm_free_sized给出的asize可能小于块的实际大小，块仍能满足该类的请求
+ */
+static void quick_push(void *bp, size_t asize, size_t limit) {
+    void **head = &QUICK(head[QUICK_IDX(asize)]);
+
+    PUT_PTR(bp, *head);
+    *head = bp;
+    QUICK(bytes) += asize;
+    QUICK(count[QUICK_IDX(asize)])++;
+    if (QUICK(bytes) > limit) {
+        quick_flush();
+    }
+}
+
+/*
+ * quick_flush - Coalesce every block of the quick lists of the current arena into the segregated lists
+ *               先把所有块标为空闲、串成一条链，再把地址相邻的块直接合并成一个块后才插入链表，
+ *               销毁对象图时相邻的块很多，每一段只需插入一次
+ */
+static void quick_flush(void) {
+    void *chain = NULL;
+    void *bp, *next, *nb;
+
+    if (QUICK(bytes) == 0)
+        return;
+
+    /* SUCC指向自身表示该块尚未处理，链接指针仍位于有效载荷的第一个字 */
+    for (int c = 0; c < QUICK_NUM; ++c) {
+        for (bp = QUICK(head[c]); bp != NULL; bp = next) {
+            size_t size = GET_SIZE(HDRP(bp));
+            next = GET_PTR(bp);
+            R_PUT(HDRP(bp), PACK(size, 0));
+            R_PUT(FTRP(bp), PACK(size, 0));
+            SET_NEXT_FREE(bp);
+            SET_SUCC(bp, bp);
+            PUT_PTR(bp, chain);
+            chain = bp;
+        }
+        QUICK(head[c]) = NULL;
+        QUICK(count[c]) = 0;
+    }
+    QUICK(bytes) = 0;
+
+    for (bp = chain; bp != NULL; bp = next) {
+        next = GET_PTR(bp);
+        /* 已被前面的块吸收，或者将由前面尚未处理的块吸收 */
+        if ((SUCC(bp) != bp) || (!GET_PREV_ALLOC(bp) && QUICK_PENDING(PREV_BLKP(bp))))
+            continue;
+
+        size_t size = GET_SIZE(HDRP(bp));
+        for (nb = NEXT_BLKP(bp); !GET_ALLOC(HDRP(nb)) && QUICK_PENDING(nb); nb = NEXT_BLKP(nb)) {
+            size += GET_SIZE(HDRP(nb));
+            SET_SUCC(nb, NULL);
+            CURSOR_MOVE(nb, bp);
+            STAT(blocks)--;
+        }
+        R_PUT(HDRP(bp), PACK(size, 0));
+        R_PUT(FTRP(bp), PACK(size, 0));
+        SET_PRED(bp,NULL);
+        SET_SUCC(bp,NULL);
+        coalesce(bp); /* 与分离链表中的邻居合并，插入链表 */
+    }
+}
+
+/*
+ * quick_flush_all - quick_flush every arena, with all the locks held in the thread-safe version
+ */
+static void quick_flush_all(void) {
+#ifndef MM_THREADS
+    if (heap_listp != NULL) {
+        quick_flush();
+    }
+#else
+    char *saved = seg_list;
+    struct arena *a = cur_arena;
+
+    for (int i = 0; i < MM_ARENAS; ++i) {
+        cur_arena = &arenas[i];
+        seg_list = arenas[i].heads;
+        quick_flush();
+    }
+    seg_list = saved;
+    cur_arena = a;
+#endif
+}
+
+/*
+ * heap_free - Free a block back to the shared heap
+ *             不超过QUICK_MAX的块压入快速链表，延迟合并
+ */
+static void heap_free (void *bp) {
+
+    if (bp == NULL) 
+        return;
+
+    if (IS_MMAPPED(bp)) {
+        __atomic_sub_fetch(&mmapped_bytes, MMAP_LEN(bp), __ATOMIC_RELAXED);
+        munmap((char *)bp - 2*DSIZE, MMAP_LEN(bp));
+        return;
+    }
+
+    /* slab中的对象没有header */
+    if (IS_SLAB(bp)) {
+        slab_free(bp);
+        return;
+    }
+
+    size_t size = GET_SIZE(HDRP(bp));
+    if (heap_listp == 0){
+        mm_init();
+    }
+
+    size_t limit = __atomic_load_n(&quick_limit, __ATOMIC_RELAXED);
+    if ((size <= QUICK_MAX) && (limit != 0)) {
+        quick_push(bp, size, limit);
+        return;
+    }
+
+    /* The second bit should be saved */
+    R_PUT(HDRP(bp), PACK(size, 0));
+    R_PUT(FTRP(bp), PACK(size, 0));
+    SET_NEXT_FREE(bp); 
+
+    SET_PRED(bp,NULL);
+    SET_SUCC(bp,NULL);
+
+    bp = coalesce(bp);
+
+    /* 堆顶的空闲块增长到trim_threshold以上时，释放超出的部分，开头的trim_threshold字节留给之后的malloc */
+    size_t threshold = __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED);
+    if ((threshold != 0) && (GET_SIZE(HDRP(bp)) > threshold) && (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)) {
+        release_block(bp, threshold);
+    }
+}
+
+
+
+
+
+/*
+ * heap_realloc - change the size of an allocated block in the shared heap
+ */
+
+
+static void *heap_realloc(void *oldptr, size_t size) {
+    //printf("realloc to %lx of size %ld called\n",PTR_VALUE(oldptr),size);
+    size_t asize;
+    size_t oldsize;
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if(oldptr == NULL) {
+        return heap_malloc(size);
+    }
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if(size == 0) {
+        heap_free(oldptr);
+        return NULL;
+    }
+
+
+    if(IS_MMAPPED(oldptr)) {
+        return mmap_realloc(oldptr, size);
+    }
+
+    /* slab中的对象只能原地缩小，其余情况重新分配 */
+    if(IS_SLAB(oldptr)) {
+        void *newptr;
+
+        oldsize = RUN_SLOT(RUN_OF(oldptr));
+        if(size <= oldsize) {
+            STAT(realloc_inplace)++;
+            return oldptr;
+        }
+        if((newptr = heap_malloc(size)) == NULL) {
+            return 0;
+        }
+        STAT(realloc_copy)++;
+        memcpy(newptr, oldptr, oldsize);
+        heap_free(oldptr);
+        return newptr;
+    }
+
+    oldsize = GET_SIZE(HDRP(oldptr));
+
+    asize = ADJUST_SIZE(size); /* 同malloc，可以少申请一个WSIZE */
+
+    /* 被扩大过的块：预留足够时直接返回，否则按几何增长留出新的预留 */
+    size_t growth = __atomic_load_n(&realloc_growth, __ATOMIC_RELAXED);
+    if(growth != 0){
+        asize = ADJUST_SIZE(size + WSIZE); /* 留出GROWN_REQ */
+    }else if(GET_GROWN(oldptr)){
+        PUT(HDRP(oldptr), GET(HDRP(oldptr)) & ~0x4); /* 关闭之后不再维护GROWN_REQ */
+    }
+    if((growth != 0) && GET_GROWN(oldptr)){
+        if((asize <= oldsize) && (2*asize >= oldsize)){
+            /* 只有比上一次大的请求才是预留省去的复制 */
+            if(size > GET(GROWN_REQ(oldptr))){
+                __atomic_add_fetch(&reserve_hits, 1, __ATOMIC_RELAXED);
+            }
+            PUT(GROWN_REQ(oldptr), size);
+            STAT(realloc_inplace)++;
+            return oldptr;
+        }
+        if(asize > oldsize){
+            asize = MAX(asize, ALIGN(oldsize * growth / 100));
+        }
+    }
+    if((growth != 0) && (asize <= oldsize)){
+        /* 缩小的块不再带有预留，按malloc的大小分割，否则多出的一个字没有GROWN位说明，mm_free_sized会把它当作大小不符 */
+        asize = ADJUST_SIZE(size);
+    }
+
+    if(asize == oldsize){
+        /* new block and old block share the same size, no need to apply for a new block */
+        STAT(realloc_inplace)++;
+        return oldptr;
+    }else if(asize > oldsize){
+        void * newptr;
+        void * next = NEXT_BLKP(oldptr);
+        size_t nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next)); /* 后一个块空闲时的大小 */
+
+        /* 块位于堆顶，或者其后的空闲块位于堆顶但不够大，先扩展堆，只扩展不足的部分：
+           多扩展的零头留在块后，会被之后的小请求占用，块再扩大时只能搬走 */
+        if((oldsize + nsize < asize) && (GET_SIZE(HDRP(nsize ? NEXT_BLKP(next) : next)) == 0)){
+            extend_heap(MAX(asize - oldsize - nsize, 2*DSIZE)/WSIZE);
+            nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+        }
+
+        /* 后一个块空闲且足够大时，吸收该块原地扩大，无需复制。
+           吸收之后剩下可以分割的零头时，只有后一个块位于堆顶才吸收：否则零头夹在块与其后的已分配块之间，
+           小请求放进去之后块再也无法扩大，一次次搬走留下的空洞又被小块隔开 */
+        if((oldsize + nsize >= asize) &&
+           (!CAN_SPLIT(oldsize + nsize - asize) || (GET_SIZE(HDRP(NEXT_BLKP(next))) == 0))){
+            size_t csize = oldsize + nsize - asize;
+
+            delete_list(next);
+            CURSOR_MOVE(next, oldptr);
+            STAT(blocks)--;
+            RELEASE_TOUCH(next, (char *)oldptr + asize + (CAN_SPLIT(csize) ? DSIZE : csize));
+            R_PUT(HDRP(oldptr),PACK(oldsize + nsize,1));
+            SET_NEXT_ALLOC(oldptr);
+            /* 同下面的缩小，多余的部分分割成空闲块 */
+            split_tail(oldptr, asize, 0);
+            if(growth != 0){
+                SET_GROWN(oldptr);
+                PUT(GROWN_REQ(oldptr), size);
+            }
+            STAT(realloc_inplace)++;
+            return oldptr;
+        }
+
+        /* new block is larger, call malloc；块的大小至少为asize。
+           带预留的大小达到映射阈值时不留预留：映射的块由mremap扩大，也没有GROWN位记录预留 */
+        size_t want = (growth != 0) ? asize - WSIZE : size;
+        size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+        if((threshold != 0) && (want >= threshold)){
+            want = size;
+        }
+        newptr = heap_malloc(want);
+
+        /* If realloc() fails the original block is left untouched  */
+        if(!newptr) {
+            return 0;
+        }
+        STAT(realloc_copy)++;
+        /*copy the data，有效载荷不包括header */
+        memcpy(newptr, oldptr, MIN(size, oldsize - WSIZE));
+        if((want != size) && !IS_MMAPPED(newptr) && !IS_SLAB(newptr)){
+            SET_GROWN(newptr);
+            PUT(GROWN_REQ(newptr), size);
+        }
+
+        /* Free the old block. */
+        heap_free(oldptr);
+
+        return newptr;
+
+    }else{
+        /* 新的大小asize小于oldsize，差值可以分割时将oldptr指向的块分割成一个已分配块和一个空闲块，同place函数。
+           分割时R_PUT已清除GROWN位；不分割时被扩大过的块仍带有预留，记录这次请求的大小 */
+        if(!split_tail(oldptr, asize, 0) && GET_GROWN(oldptr)){
+            PUT(GROWN_REQ(oldptr), size);
+        }
+
+        STAT(realloc_inplace)++;
+        return oldptr;
+    }
+    
+}
+
+
+
+
+
+
+#ifdef MM_LATENCY
+/* 计时的版本中，以下四个函数改名为lat_*，文件末尾的同名函数抽样计时后调用它们 */
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#define malloc  lat_malloc
+#define free    lat_free
+#define realloc lat_realloc
+#define calloc  lat_calloc
+static void *malloc(size_t size);
+static void free(void *bp);
+static void *realloc(void *oldptr, size_t size);
+static void *calloc(size_t nmemb, size_t size);
+#endif
+
+/*
+ * malloc - Ask for a block
+ * 线程安全的版本中，不超过TC_MAX的块优先从线程缓存中取
+ */
+void *malloc (size_t size) {
+    CHECK_TICK();
+#ifndef MM_THREADS
+    seed_vote(size);
+    return heap_malloc(size);
+#else
+    struct arena *a = arena_get();
+    void *bp;
+
+    /* 独占缓存行的块不经过线程缓存，由heap_malloc对齐 */
+    if ((size != 0) && (size > __atomic_load_n(&cache_align, __ATOMIC_RELAXED))){
+        if (size <= __atomic_load_n(&slab_limit, __ATOMIC_RELAXED)){
+            return tc_malloc(TC_SLAB(SLAB_IDX(size)));
+        }
+        if (size <= TC_MAX - WSIZE){
+            return tc_malloc(TC_IDX(ADJUST_SIZE(size)));
+        }
+    }
+
+    arena_lock(a);
+    seed_vote(size);
+    bp = heap_malloc(size);
+    arena_unlock(a);
+    return bp;
+#endif
+}
+
+/*
+ * free - Free a block
+ * 线程安全的版本中，不超过TC_MAX的块放入线程缓存
+ */
+void free (void *bp) {
+
+    if (bp == NULL) 
+        return;
+
+    CHECK_TICK();
+#ifndef MM_THREADS
+    heap_free(bp);
+#else
+    struct arena *a = arena_get();
+    size_t size;
+
+    if (IS_MMAPPED(bp)){
+        heap_free(bp);
+        return;
+    }
+    if (IS_SLAB(bp)){
+        tc_free(bp, TC_SLAB(SLAB_IDX(RUN_SLOT(RUN_OF(bp)))));
+        return;
+    }
+
+    /* 不持有锁，倒数第二位可能正被其他线程修改，但大小不会变 */
+    size = GET_SIZE(HDRP(bp));
+    if (size <= TC_MAX){
+        tc_free(bp, TC_IDX(size));
+        return;
+    }
+
+    /* 其他arena的块交给它的主人释放 */
+    if (ARENA_OF(bp) != a){
+        remote_push(ARENA_OF(bp), bp);
+        return;
+    }
+    arena_lock(a);
+    heap_free(bp);
+    arena_unlock(a);
+#endif
+}
+
+/*
+ * realloc - change the size of an allocated block
+ */
+void *realloc(void *oldptr, size_t size) {
+    CHECK_TICK();
+#ifndef MM_THREADS
+    return heap_realloc(oldptr, size);
+#else
+    struct arena *a;
+    void *newptr;
+
+    /* 这两种情况交给malloc和free，以便经过线程缓存 */
+    if(oldptr == NULL) {
+        return malloc(size);
+    }
+    if(size == 0) {
+        free(oldptr);
+        return NULL;
+    }
+
+    /* 在块所属的arena中调整大小，新块也从该arena中分配；映射的块需要时从自己的arena中分配 */
+    a = arena_get();
+    if(!IS_MMAPPED(oldptr)) {
+        a = ARENA_OF(oldptr);
+    }
+    arena_lock(a);
+    newptr = heap_realloc(oldptr, size);
+    arena_unlock(a);
+    return newptr;
+#endif
+}
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes into out;
+ *                   return how many were allocated, the rest of out is set to NULL
+ *                   线程安全的版本中不经过线程缓存，在自己的arena中持锁一次完成
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t cnt;
+
+    CHECK_TICK();
+#ifndef MM_THREADS
+    cnt = heap_malloc_batch(size, n, out);
+#else
+    struct arena *a = arena_get();
+
+    arena_lock(a);
+    cnt = heap_malloc_batch(size, n, out);
+    arena_unlock(a);
+#endif
+    for (size_t i = cnt; i < n; ++i) {
+        out[i] = NULL;
+    }
+    return cnt;
+}
+
+/*
+ * mm_free_batch - Free the n blocks of ptrs, which may contain NULL;
+ *                 ptrs is sorted by address in place, so that every run of adjacent blocks
+ *                 becomes one free block, coalesced and inserted into the lists only once
+ *                 mm_malloc_batch切分出的块已按地址排列，此时不调用qsort。
+ *                 不经过快速链表和线程缓存：快速链表的意义在于推迟合并，而这里排序之后合并一段只需一次coalesce，
+ *                 与quick_flush的代价相同；放进快速链表反而要在之后的quick_flush中再处理一遍，
+ *                 且超过quick_limit时整批触发合并。需要同样大小的块时，mm_malloc_batch仍先取快速链表。
+ *                 线程安全的版本中依次持有各段所属arena的锁
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    size_t i, j;
+#ifdef MM_THREADS
+    struct arena *a = NULL;
+
+    arena_get();
+#endif
+
+    CHECK_TICK();
+    for (i = 1; (i < n) && (ptr_cmp(&ptrs[i - 1], &ptrs[i]) <= 0); ++i)
+        ;
+    if (i < n) {
+        qsort(ptrs, n, sizeof(void *), ptr_cmp);
+    }
+    for (i = 0; i < n; i = j) {
+        char *bp = ptrs[i];
+
+        j = i + 1;
+        if (bp == NULL)
+            continue;
+        if (IS_MMAPPED(bp)) {
+            heap_free(bp);
+            continue;
+        }
+#ifdef MM_THREADS
+        if (ARENA_OF(bp) != a) {
+            if (a != NULL) {
+                arena_unlock(a);
+            }
+            a = ARENA_OF(bp);
+            arena_lock(a);
+        }
+#endif
+        if (IS_SLAB(bp)) {
+            slab_free(bp);
+            continue;
+        }
+
+        /* 之后紧邻的块直接并入bp */
+        size_t size = GET_SIZE(HDRP(bp));
+        while ((j < n) && ((char *)ptrs[j] == bp + size) && !IS_SLAB(ptrs[j])
+#ifdef MM_THREADS
+               && (ARENA_OF(ptrs[j]) == a)
+#endif
+              ) {
+            size += GET_SIZE(HDRP(ptrs[j]));
+            CURSOR_MOVE(ptrs[j], bp);
+            STAT(blocks)--;
+            ++j;
+        }
+
+        /* The second bit should be saved */
+        R_PUT(HDRP(bp), PACK(size, 0));
+        R_PUT(FTRP(bp), PACK(size, 0));
+        SET_NEXT_FREE(bp);
+        SET_PRED(bp,NULL);
+        SET_SUCC(bp,NULL);
+        coalesce(bp);
+    }
+#ifdef MM_THREADS
+    if (a != NULL) {
+        arena_unlock(a);
+    }
+#endif
+}
+
+/*
+ * heap_malloc_batch - Allocate n blocks of size bytes from the shared heap into out;
+ *                     return how many were allocated
+ *                     同样大小的块先从快速链表中取，其余的从一次find_fit得到的块中切分
+ */
+static size_t heap_malloc_batch(size_t size, size_t n, void **out) {
+    size_t i = 0;
+
+    if (heap_listp == NULL){
+        mm_init();
+    }
+    if (size == 0)
+        return 0;
+
+    /* slab的槽、独占缓存行的块和映射的块没有可以一起切分的 */
+    size_t threshold = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+    if ((size <= __atomic_load_n(&slab_limit, __ATOMIC_RELAXED))
+        || (size <= __atomic_load_n(&cache_align, __ATOMIC_RELAXED))
+        || ((threshold != 0) && (size >= threshold))) {
+        for (; (i < n) && ((out[i] = heap_malloc(size)) != NULL); ++i)
+            ;
+        return i;
+    }
+
+    size_t asize = ADJUST_SIZE(size);
+    if ((asize >= SEED_FROM) && (asize <= SEED_LAST) && !STAT(seed_off)) {
+        STAT(seed_rounded) += n;
+        asize = SEED_TO;
+    }
+    if (asize <= QUICK_MAX) {
+        for (; (i < n) && ((out[i] = quick_pop(asize)) != NULL); ++i)
+            ;
+    }
+
+    while (i < n) {
+        size_t k = MIN(n - i, (1UL << 30) / asize); /* 一次切分不超过1GB */
+        char *bp = alloc_block(k * asize);
+
+        if (bp == NULL)
+            break;
+        carve(bp, asize, k, out + i);
+        i += k;
+    }
+    return i;
+}
+
+/*
+ * carve - Split the allocated block bp of at least k*asize bytes into k allocated blocks,
+ *         the last one taking what is left over
+ */
+static void carve(char *bp, size_t asize, size_t k, void **out) {
+    size_t size = GET_SIZE(HDRP(bp));
+
+    for (size_t j = 0; j + 1 < k; ++j) {
+        R_PUT(HDRP(bp), PACK(asize, 1));
+        out[j] = bp;
+        bp += asize;
+        size -= asize;
+        PUT(HDRP(bp), PACK(size, 1) | 0x2); /* 前一个块已分配 */
+    }
+    out[k - 1] = bp;
+    STAT(blocks) += k - 1;
+}
+
+/* 按地址比较两个指针，供qsort使用 */
+static int ptr_cmp(const void *a, const void *b) {
+    unsigned long x = PTR_VALUE(*(void * const *)a);
+    unsigned long y = PTR_VALUE(*(void * const *)b);
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * mm_free_sized - Free the block bp that was allocated with size bytes
+ *                 堆中的块不读header，直接按size放入快速链表（线程安全的版本中为线程缓存）；
+ *                 映射的块、slab的槽以及放不进缓存的块同free
+ *                 定义MM_SIZED_CHECK时核对header，不符时报告并按header释放
+ */
+void mm_free_sized(void *bp, size_t size) {
+    size_t asize = ADJUST_SIZE(size);
+
+    if (bp == NULL)
+        return;
+
+#ifdef MM_SIZED_CHECK
+    if (!sized_ok(bp, size)) {
+        free(bp);
+        return;
+    }
+    /* 已经读过header，按块的实际大小归类，快速链表中的块就不会被当作更小的块交给别的请求 */
+    if (!IS_MMAPPED(bp) && !IS_SLAB(bp))
+        asize = GET_SIZE(HDRP(bp));
+#endif
+    /* slab_map和地址本身即可区分，不读取块的内容 */
+    if (IS_MMAPPED(bp) || IS_SLAB(bp)) {
+        free(bp);
+        return;
+    }
+
+#ifndef MM_THREADS
+    size_t limit = __atomic_load_n(&quick_limit, __ATOMIC_RELAXED);
+    if ((asize > QUICK_MAX) || (limit == 0) || (heap_listp == NULL)) {
+        free(bp);
+        return;
+    }
+    CHECK_TICK();
+    quick_push(bp, asize, limit);
+#else
+    if (asize > TC_MAX) {
+        free(bp);
+        return;
+    }
+    CHECK_TICK();
+    arena_get();
+    tc_free(bp, TC_IDX(asize));
+#endif
+}
+
+/*
+ * mm_memalign - Ask for a block of size bytes whose payload is aligned to alignment,
+ *               which must be a power of 2
+ *               alignment不超过DSIZE时同malloc，否则总是从堆中分配（slab的槽与映射的块无法对齐）；
+ *               返回的块与其他块一样可以free、realloc，realloc不保持对齐
+ */
+void *mm_memalign(size_t alignment, size_t size) {
+    void *bp;
+
+    if ((alignment & (alignment - 1)) != 0)
+        return NULL;
+    if (alignment <= DSIZE)
+        return malloc(size);
+
+    CHECK_TICK();
+#ifndef MM_THREADS
+    bp = heap_memalign(alignment, size);
+#else
+    struct arena *a = arena_get();
+
+    arena_lock(a);
+    bp = heap_memalign(alignment, size);
+    arena_unlock(a);
+#endif
+    return bp;
+}
+
+/*
+ * mm_posix_memalign - Store in *memptr a block of size bytes aligned to alignment;
+ *                     return 0, EINVAL if alignment is not a power of 2 multiple of sizeof(void *),
+ *                     or ENOMEM (leaving *memptr unchanged)
+ */
+int mm_posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *bp;
+
+    if ((alignment < sizeof(void *)) || ((alignment & (alignment - 1)) != 0))
+        return EINVAL;
+    bp = mm_memalign(alignment, size);
+    if ((bp == NULL) && (size != 0))
+        return ENOMEM;
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_aligned_alloc - C11 aligned_alloc; size need not be a multiple of alignment
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    return mm_memalign(alignment, size);
+}
+
+/*
+ * heap_memalign - Allocate a block of size bytes whose payload is aligned to align
+ *                 (a power of 2 above DSIZE) from the shared heap
+ *                 对齐点之前、之后多余的部分由alloc_aligned作为空闲块合并
+ */
+static void *heap_memalign(size_t align, size_t size) {
+
+    if (heap_listp == NULL){
+        mm_init();
+    }
+    if (size == 0)
+        return NULL;
+
+    /* 块的大小须能放进header */
+    if ((size > (1UL << 30)) || (align > (1UL << 30)))
+        return NULL;
+    return alloc_aligned(align, ADJUST_SIZE(size));
+}
+
+#ifdef MM_SIZED_CHECK
+/*
+ * sized_ok - Return 1 if bp is an allocated block that holds at least size bytes
+ *            and is no larger than a request of size bytes can get,
+ *            else report it and return 0; return 0 without a report for a grown block
+ */
+static int sized_ok(void *bp, size_t size) {
+    size_t have, most;
+
+    if (IS_MMAPPED(bp)) {
+        have = MMAP_LEN(bp) - 2*DSIZE;
+        most = PAGE_UP(size + 2*DSIZE) - 2*DSIZE;
+    } else if (IS_SLAB(bp)) {
+        /* realloc原地缩小的槽仍是原来的大小，而槽本身不超过SLAB_MAX */
+        have = RUN_SLOT(RUN_OF(bp));
+        most = SLAB_MAX;
+    } else if (GET_ALLOC(HDRP(bp))) {
+        size_t asize = ADJUST_SIZE(size);
+
+        /* 预留使块可以任意大，而且快速链表按size归类，弹出之后会被当作小得多的块 */
+        if (GET_GROWN(bp))
+            return 0;
+        have = GET_SIZE(HDRP(bp)) - WSIZE;
+        /* 预置规则可能在分配之后才停用 */
+        if ((asize >= SEED_FROM) && (asize <= SEED_LAST))
+            asize = SEED_TO;
+        if (size <= __atomic_load_n(&cache_align, __ATOMIC_RELAXED))
+            asize = MAX(asize, LINE_SIZE(size));
+        /* place不分割不足split_min的零头 */
+        most = asize + __atomic_load_n(&split_min, __ATOMIC_RELAXED) - DSIZE - WSIZE;
+    } else {
+        printf("free_sized: block %lx (header %08x) is not allocated\n", PTR_VALUE(bp), GET(HDRP(bp)));
+        return 0;
+    }
+    if ((size > have) || (have > most)) {
+        printf("free_sized: block %lx holds %zu bytes, freed as %zu bytes\n", PTR_VALUE(bp), have, size);
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+
+
+#ifdef MM_THREADS
+
+/*
+ * arena_setup - 初始化各arena的锁，只执行一次
+ */
+static void arena_setup(void){
+    for(int i = 0;i < MM_ARENAS;++i){
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    }
+}
+
+/*
+ * arena_get - Return the arena of the calling thread,
+ *             initializing the heap on first use and picking an arena round-robin for a new thread
+ */
+static struct arena *arena_get(void){
+
+    if(!__atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE)){
+        pthread_mutex_lock(&init_lock);
+        if(!heap_ready){
+            mm_init();
+        }
+        pthread_mutex_unlock(&init_lock);
+    }
+    if(my_arena == NULL){
+        my_arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % MM_ARENAS];
+    }
+    return my_arena;
+}
+
+/*
+ * arena_lock - Lock arena a, make its lists current,
+ *              and free the blocks other threads have pushed onto its remote stack
+ */
+static void arena_lock(struct arena *a){
+    void *bp;
+
+    pthread_mutex_lock(&a->lock);
+    cur_arena = a;
+    seg_list = a->heads;
+
+    if(__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL){
+        return;
+    }
+    bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    while(bp != NULL){
+        void *next = TC_NEXT(bp);
+        heap_free(bp);
+        bp = next;
+    }
+}
+
+static void arena_unlock(struct arena *a){
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * remote_push - Push the block bp onto the remote stack of arena a without locking
+ */
+static void remote_push(struct arena *a, void *bp){
+    void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    do{
+        TC_NEXT(bp) = head;
+    }while(!__atomic_compare_exchange_n(&a->remote, &head, bp, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * arena_free - 持有cur_arena的锁时释放块bp，其他arena的块压入其remote栈
+ */
+static void arena_free(void *bp){
+    struct arena *a = ARENA_OF(bp);
+
+    if(a == cur_arena){
+        heap_free(bp);
+    }else{
+        remote_push(a, bp);
+    }
+}
+
+/*
+ * claim_granules - 将[lo,hi)覆盖的粒度记为cur_arena所有，须持有sbrk_lock
+ */
+static void claim_granules(char *lo, char *hi){
+    unsigned int first = (unsigned int)PTR_VALUE(lo) >> GRAN_BITS;
+    unsigned int last = (unsigned int)(PTR_VALUE(hi) - 1) >> GRAN_BITS;
+
+    for(unsigned int g = first;g <= last;++g){
+        arena_of[g] = (unsigned char)(cur_arena - arenas);
+    }
+}
+
+/*
+ * new_segment - Start a new segment of cur_arena at the next granule boundary
+ *               with a free block of size bytes, must hold sbrk_lock.
+ *               The old epilogue becomes an allocated block covering the gap.
+ */
+static void *new_segment(size_t size){
+    char *brk = (char *)mem_heap_hi() + 1;
+    char *bp = (char *)GRAN_UP(brk) + 2*DSIZE; /* 留出间隔块的最小大小 */
+
+    unsigned int zero = (brk >= zero_brk) ? ZERO_BIT : 0;
+
+    if (mem_sbrk((bp - brk) + size) == (void *)-1)
+        return NULL;
+    zero_brk = MAX(zero_brk, bp + size);
+
+    /* 结尾块的倒数第二位属于堆顶arena的最后一个块，只能原子地加上大小 */
+    __atomic_fetch_or((unsigned int *)HDRP(brk), (unsigned int)(bp - brk), __ATOMIC_RELAXED);
+
+    PUT(HDRP(bp), PACK(size, 0x2 | zero)); /* Free block header，前一个块（间隔块）已分配 */
+    PUT(FTRP(bp), PACK(size, zero));       /* Free block footer */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+    SET_PRED(bp,NULL);
+    SET_SUCC(bp,NULL);
+
+    claim_granules(bp, bp + size);
+    top_arena = cur_arena;
+    STAT(blocks) += 2; /* 间隔块与新的空闲块 */
+    return bp;
+}
+
+/*
+ * lock_all - 依次获取所有arena的锁以及sbrk_lock，整个堆在此期间不会改变
+ */
+static void lock_all(void){
+    for(int i = 0;i < MM_ARENAS;++i){
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    pthread_mutex_lock(&sbrk_lock);
+}
+
+static void unlock_all(void){
+    pthread_mutex_unlock(&sbrk_lock);
+    for(int i = MM_ARENAS - 1;i >= 0;--i){
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+}
+
+/*
+ * tc_reset - 清空当前线程的缓存（堆被mm_init重置后缓存中的块已不存在），
+ *            并登记线程退出时归还缓存
+ */
+static void tc_destroy(void *arg);
+
+static void tc_make_key(void){
+    pthread_key_create(&tc_key, tc_destroy);
+}
+
+static void tc_reset(void){
+    pthread_once(&tc_once, tc_make_key);
+    pthread_setspecific(tc_key, &tcache);
+    memset(&tcache, 0, sizeof(tcache));
+    tcache.gen = HEAP_GEN();
+}
+
+/*
+ * tc_malloc - Pop a block of class c from the thread cache;
+ *             if the class is empty, take TC_FILL blocks from the heap under one lock
+ */
+static void *tc_malloc(int c){
+    void *bp;
+
+    if((tcache.gen == HEAP_GEN()) && ((bp = tcache.head[c]) != NULL)){
+        tcache.head[c] = TC_NEXT(bp);
+        tcache.count[c]--;
+        return bp;
+    }
+
+    arena_lock(my_arena);
+    if(tcache.gen != HEAP_GEN()){
+        tc_reset();
+    }
+    bp = TC_ALLOC(c);
+    for(int i = 1;(bp != NULL) && (i < TC_FILL);++i){
+        void *extra = TC_ALLOC(c);
+        if(extra == NULL){
+            break;
+        }
+        TC_NEXT(extra) = tcache.head[c];
+        tcache.head[c] = extra;
+        tcache.count[c]++;
+    }
+    arena_unlock(my_arena);
+
+    return bp;
+}
+
+/*
+ * tc_free - Push the block bp of class c onto the thread cache;
+ *           give half of the class back to the heap once it holds more than TC_LIMIT blocks
+ */
+static void tc_free(void *bp, int c){
+
+    if(tcache.gen != HEAP_GEN()){
+        tc_reset();
+    }
+
+    TC_NEXT(bp) = tcache.head[c];
+    tcache.head[c] = bp;
+    if(++tcache.count[c] > TC_LIMIT){
+        tc_flush(c, TC_LIMIT / 2);
+    }
+}
+
+/*
+ * tc_flush - Give n blocks of class c back to the heap under one lock
+ */
+static void tc_flush(int c, unsigned int n){
+    struct arena *a = arena_get();
+
+    arena_lock(a);
+    while((n-- > 0) && (tcache.head[c] != NULL)){
+        void *bp = tcache.head[c];
+        tcache.head[c] = TC_NEXT(bp);
+        tcache.count[c]--;
+        arena_free(bp);
+    }
+    arena_unlock(a);
+}
+
+/*
+ * tc_destroy - 线程退出时把缓存中的块全部归还
+ */
+static void tc_destroy(void *arg){
+
+    (void)arg;
+    if(tcache.gen != HEAP_GEN()){
+        return;
+    }
+    for(int c = 0;c < TC_CLASSES;++c){
+        if(tcache.count[c] > 0){
+            tc_flush(c, tcache.count[c]);
+        }
+    }
+}
+
+#endif /* def MM_THREADS */
+
+
+
+/*
+ * Calloc - malloc a block with the size of nmemb*size,and initialize it to zero
+ */
+void *calloc (size_t nmemb, size_t size) {
+    size_t bytes;
+    void *newptr;
+
+    /* nmemb*size溢出 */
+    if ((nmemb != 0) && (size > ((size_t)-1) / nmemb))
+        return NULL;
+    bytes = nmemb * size;
+
+    zero_placed = NULL;
+    newptr = malloc(bytes);
+    if (newptr == NULL)
+        return NULL;
+
+    /* 新的映射全为0 */
+    if (IS_MMAPPED(newptr))
+        return newptr;
+
+    /* 从已知为0的块中分配：只有前驱、后继以及未分割时残留的原footer不为0 */
+    if (newptr == zero_placed) {
+        memset(newptr, 0, DSIZE);
+        PUT(FTRP(newptr), 0);
+        return newptr;
+    }
 
-            void * cp = NEXT_BLKP(oldptr);
-            R_PUT(HDRP(cp),PACK(csize,0));
-            PUT(FTRP(cp),PACK(csize,0));
-            SET_NEXT_FREE(cp);
-            SET_PRED(cp,NULL);
-            SET_SUCC(cp,NULL);
+    memset(newptr, 0, bytes);
+    return newptr;
+}
 
-            coalesce(cp);
-        }
+#ifdef MM_LATENCY
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#ifdef DRIVER
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif
 
-        return oldptr;
+/*
+ * lat_begin - Return 1 if the current call is sampled, starting a new set of slow path tags
+ */
+static inline int lat_begin(void) {
+    if (lat_countdown > 1) {
+        lat_countdown--;
+        return 0;
     }
-    
+    lat_countdown = __atomic_load_n(&lat_sample, __ATOMIC_RELAXED);
+    lat_tags = 0;
+    return lat_countdown != 0;
 }
 
+/*
+ * lat_record - Count a sampled call of operation op that took cycles,
+ *              also in the histogram of every slow path it went through
+ */
+static void lat_record(int op, unsigned long cycles) {
+    int b = 63 - __builtin_clzl(cycles | 1);
+    unsigned int tags = lat_tags;
+
+    __atomic_add_fetch(&lat_hist[op][b], 1, __ATOMIC_RELAXED);
+    while (tags != 0) {
+        int t = __builtin_ctz(tags);
+        tags &= tags - 1;
+        __atomic_add_fetch(&lat_hist[MM_LAT_OPS + t][b], 1, __ATOMIC_RELAXED);
+    }
+}
 
+void *malloc (size_t size) {
+    if (!lat_begin())
+        return lat_malloc(size);
+    unsigned long t = LAT_NOW();
+    void *bp = lat_malloc(size);
+    lat_record(MM_LAT_MALLOC, LAT_NOW() - t);
+    return bp;
+}
 
+void free (void *bp) {
+    if (!lat_begin()) {
+        lat_free(bp);
+        return;
+    }
+    unsigned long t = LAT_NOW();
+    lat_free(bp);
+    lat_record(MM_LAT_FREE, LAT_NOW() - t);
+}
 
+void *realloc(void *oldptr, size_t size) {
+    if (!lat_begin())
+        return lat_realloc(oldptr, size);
+    unsigned long t = LAT_NOW();
+    void *bp = lat_realloc(oldptr, size);
+    lat_record(MM_LAT_REALLOC, LAT_NOW() - t);
+    return bp;
+}
 
+void *calloc (size_t nmemb, size_t size) {
+    if (!lat_begin())
+        return lat_calloc(nmemb, size);
+    unsigned long t = LAT_NOW();
+    void *bp = lat_calloc(nmemb, size);
+    lat_record(MM_LAT_CALLOC, LAT_NOW() - t);
+    return bp;
+}
+#endif /* def MM_LATENCY */
 
 /*
- * Calloc - malloc a block with the size of nmemb*size,and initialize it to zero
+ * mm_latency - Copy the latency histograms into lat; return 0,
+ *              or -1 (with lat cleared) if the library was built without MM_LATENCY
  */
-void *calloc (size_t nmemb, size_t size) {
-    size_t bytes = nmemb * size;
-    void *newptr;
-
-    newptr = malloc(bytes);
-    memset(newptr, 0, bytes);
+int mm_latency(struct mm_latency *lat) {
+#ifdef MM_LATENCY
+    for (int i = 0; i < MM_LAT_OPS + MM_LAT_TAGS; ++i) {
+        for (int b = 0; b < MM_LAT_BUCKETS; ++b) {
+            unsigned long n = __atomic_load_n(&lat_hist[i][b], __ATOMIC_RELAXED);
+            if (i < MM_LAT_OPS)
+                lat->op[i][b] = n;
+            else
+                lat->tag[i - MM_LAT_OPS][b] = n;
+        }
+    }
+    return 0;
+#else
+    memset(lat, 0, sizeof(*lat));
+    return -1;
+#endif
+}
 
-    return newptr;
+/*
+ * mm_latency_reset - Clear the latency histograms
+ */
+void mm_latency_reset(void) {
+#ifdef MM_LATENCY
+    for (int i = 0; i < MM_LAT_OPS + MM_LAT_TAGS; ++i) {
+        for (int b = 0; b < MM_LAT_BUCKETS; ++b) {
+            __atomic_store_n(&lat_hist[i][b], 0, __ATOMIC_RELAXED);
+        }
+    }
+#endif
 }
 
 
@@ -417,21 +2812,47 @@ static void *extend_heap(size_t words)
     //printf("heap extended with %ld words\n",words);
     char *bp;
     size_t size;
+    unsigned int zero;
 
     /* Allocate an even number of words to maintain alignment */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE; 
+    STAT(extend_heap)++;
+    LAT_TAG(MM_LAT_EXTEND);
+
+#ifdef MM_THREADS
+    /* 堆顶属于其他arena时不能接在其后，另起一段 */
+    pthread_mutex_lock(&sbrk_lock);
+    if (top_arena != cur_arena){
+        bp = new_segment(size);
+        pthread_mutex_unlock(&sbrk_lock);
+        return (bp == NULL) ? NULL : coalesce(bp);
+    }
+#endif
 
-    if ((long)(bp = mem_sbrk(size)) == -1)  
+    if ((long)(bp = mem_sbrk(size)) == -1){
+#ifdef MM_THREADS
+        pthread_mutex_unlock(&sbrk_lock);
+#endif
         return NULL;                                        
+    }
+    /* 从未到达过的内存全为0 */
+    zero = (bp >= zero_brk) ? ZERO_BIT : 0;
+    zero_brk = MAX(zero_brk, bp + size);
 
     /* Initialize free block header/footer and the epilogue header */
-    R_PUT(HDRP(bp), PACK(size, 0));         /* Free block header */   
-    R_PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
+    R_PUT(HDRP(bp), PACK(size, zero));      /* Free block header */   
+    R_PUT(FTRP(bp), PACK(size, zero));      /* Free block footer */
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */ 
+    STAT(blocks)++;
     
     SET_PRED(bp,NULL);
     SET_SUCC(bp,NULL);
 
+#ifdef MM_THREADS
+    claim_granules(bp, bp + size);
+    pthread_mutex_unlock(&sbrk_lock);
+#endif
+
     /* Coalesce if the previous block was free */
     return coalesce(bp);                                         
 }
@@ -445,34 +2866,51 @@ static void *extend_heap(size_t words)
 static void place(void *bp, size_t asize)
 {   
     size_t csize = GET_SIZE(HDRP(bp));   
-    
+    unsigned int zero = GET_ALLOC(HDRP(bp)) ? 0 : GET_ZERO(bp);
+
+    zero_placed = zero ? bp : NULL;
 
     /* delete the block from free list*/
     if(!GET_ALLOC(HDRP(bp))){
         delete_list(bp);
     }
 
-    if ((csize - asize) >= (2*DSIZE)) { 
+    /* 分割时还要写入剩余部分的前驱、后继 */
+    RELEASE_TOUCH(bp, (char *)bp + (CAN_SPLIT(csize - asize) ? asize + DSIZE : csize));
+    R_PUT(HDRP(bp), PACK(csize, 1));
+    SET_NEXT_ALLOC(bp);
 
-        R_PUT(HDRP(bp), PACK(asize, 1));
-        R_PUT(FTRP(bp), PACK(asize, 1));
-        SET_NEXT_ALLOC(bp);
+    /* 剩余部分的内部不曾被写过，仍然已知为0 */
+    split_tail(bp, asize, zero);
+}
 
-        bp = NEXT_BLKP(bp);
+/*
+ * split_tail - Shrink the allocated block bp to asize bytes if the rest can be split off,
+ *              and free the rest as a block with the given zero bit; return 1 if it split
+ *              place、alloc_aligned以及heap_realloc的扩大和缩小都由此分割，是否分割只看CAN_SPLIT。
+ *              已分配块没有footer，不能写入bp的footer：realloc时那里是有效载荷。
+ *              bp的header由R_PUT重写，GROWN位随之清除，需要时由调用者重新设置
+ */
+static int split_tail(void *bp, size_t asize, unsigned int zero)
+{
+    size_t csize = GET_SIZE(HDRP(bp)) - asize;
+    void *cp;
 
-        R_PUT(HDRP(bp), PACK(csize-asize, 0));
-        R_PUT(FTRP(bp), PACK(csize-asize, 0));
-        SET_NEXT_FREE(bp);
-        SET_PRED(bp,NULL);
-        SET_SUCC(bp,NULL);        
-        coalesce(bp);
-    }
-    else { 
-        R_PUT(HDRP(bp), PACK(csize, 1));
-        R_PUT(FTRP(bp), PACK(csize, 1));
-        SET_NEXT_ALLOC(bp);
-    }
+    if (!CAN_SPLIT(csize))
+        return 0;
 
+    R_PUT(HDRP(bp), PACK(asize, 1));
+    SET_NEXT_ALLOC(bp);
+
+    cp = NEXT_BLKP(bp);
+    R_PUT(HDRP(cp), PACK(csize, zero));
+    PUT(FTRP(cp), PACK(csize, zero));
+    SET_NEXT_FREE(cp);
+    SET_PRED(cp, NULL);
+    SET_SUCC(cp, NULL);
+    STAT(blocks)++;
+    coalesce(cp);
+    return 1;
 }
 
 
@@ -485,31 +2923,49 @@ static void *coalesce(void *bp)
     size_t prev_alloc = (GET_PREV_ALLOC(bp) >> 1); /* 不能使用PREV_BLKP，因为前一个块不一定有footer */
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
+    unsigned int zero = GET_ZERO(bp); /* 合并后的块是否已知为0 */
+    void *self = bp;
+    void *next = NEXT_BLKP(bp);
 
     //printf("%lx,%ld,%ld,%ld\n",PTR_VALUE(bp),prev_alloc,next_alloc,size);
    
     if (prev_alloc && next_alloc) {            /* Case 1 */
-        SET_NEXT_FREE(bp);
-        insert_list(bp);
-        return bp;
+        STAT(coalesce[0])++;
     }
 
     else if (prev_alloc && !next_alloc) {      /* Case 2 */
+        STAT(coalesce[1])++;
+        STAT(blocks)--;
+        zero = zero && GET_ZERO(next);
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
         delete_list(NEXT_BLKP(bp));
+        CURSOR_MOVE(next, bp);
         R_PUT(HDRP(bp), PACK(size, 0));
         R_PUT(FTRP(bp), PACK(size, 0));
+        if (zero) {
+            CLEAR_JOINT(next);
+        }
     }
 
     else if (!prev_alloc && next_alloc) {      /* Case 3 */
+        STAT(coalesce[2])++;
+        STAT(blocks)--;
+        zero = zero && GET_ZERO(PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
         delete_list(PREV_BLKP(bp));
         R_PUT(FTRP(bp), PACK(size, 0));
         R_PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
+        CURSOR_MOVE(self, bp);
+        if (zero) {
+            CLEAR_JOINT(self);
+        }
     }
 
     else {                                     /* Case 4 */
+        STAT(coalesce[3])++;
+        STAT(blocks) -= 2;
+        zero = zero && GET_ZERO(PREV_BLKP(bp)) && GET_ZERO(next);
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
             GET_SIZE(FTRP(NEXT_BLKP(bp)));
         delete_list(PREV_BLKP(bp));
@@ -517,8 +2973,18 @@ static void *coalesce(void *bp)
         R_PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
         R_PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
         bp = PREV_BLKP(bp);
+        CURSOR_MOVE(self, bp);
+        CURSOR_MOVE(next, bp);
+        if (zero) {
+            CLEAR_JOINT(self);
+            CLEAR_JOINT(next);
+        }
     }
 
+    if (zero) {
+        PUT(HDRP(bp), GET(HDRP(bp)) | ZERO_BIT);
+        PUT(FTRP(bp), GET(FTRP(bp)) | ZERO_BIT);
+    }
     SET_NEXT_FREE(bp);
     insert_list(bp);
     return bp;
@@ -529,50 +2995,78 @@ static void *coalesce(void *bp)
  */
 static void *find_fit(size_t asize)
 {   
-  
-    for(int idx = list_idx(asize); idx < LISTNUM;++idx){
+    int idx = list_idx(asize);
 
-       /* 从索引为idx的链表开始搜索，如果当前链表没有搜到就换更大的链表 */
-       /* 每个链表内的块按大小从小到大排序，确保了首次适配即最佳适配 */
+    STAT(fit_searches)++;
+
+    /* 先在asize所属的链表中搜索，该链表中的块不一定足够大 */
+    if(idx >= TREE_LIST){
+        /* 大块链表为treap，直接找最佳适配 */
+        void * bp = tree_fit(seg_list + idx * WSIZE, asize);
+        if(bp != NULL){
+            return bp;
+        }
+    }else{
+        /* 每个链表内的块按大小从小到大排序，确保了首次适配即最佳适配 */
         void * bp = GET_PTR(seg_list + idx * WSIZE); 
+        unsigned long probes = 0;
 
         while(bp != NULL){
+            probes++;
             /* 找到一个足够大的空闲块 */
             if(GET_SIZE(HDRP(bp)) >= (asize)){
-               // printf("A block with size %d is found. asize is %ld\n",GET_SIZE(HDRP(bp)),asize);
+                STAT(fit_probes) += probes;
+                LAT_SCAN(probes, MM_LAT_LONG_FIT);
                 return bp;
             }
             bp = SUCC(bp);
         }
+        STAT(fit_probes) += probes;
+        LAT_SCAN(probes, MM_LAT_LONG_FIT);
+    }
 
+    /* 更大的链表中任意一个块都足够大，借助位图直接找到第一个非空的链表，取其中最小的块 */
+    unsigned long map = LIST_MAP & (~0UL << (idx + 1));
+    if(map == 0){
+        /* size比所有的空闲块的大小都大 */
+        return NULL;
+    }
+    idx = __builtin_ctzl(map);
+
+    if(idx >= TREE_LIST){
+        return tree_fit(seg_list + idx * WSIZE, asize);
     }
-    //printf("Not Found\n");
-    /* size比所有的空闲块的大小都大 */
-    return NULL;
+    STAT(fit_probes)++;
+    return GET_PTR(seg_list + idx * WSIZE);
 }
 
 /* 
  * list_idx - Given the size of a free block;
  *            return the idx of the list it belongs to.
- *            idx range: [0,9]
+ *            idx range: [0,LISTNUM-1]
+ * 
+ * 最高有效位由__builtin_clzl得到，所属的2的幂区间由最高有效位减去第一个区间的位数再截断得到，
+ * 默认bit<=4:[1,32)，bit=5~12:[32,64)~[4096,8192)，bit>=13:[8192,+INF)。
+ * 区间内的子区间由最高有效位之后的SUBLIST_BITS位决定，整个过程没有循环。
  */
 
 static int list_idx(size_t size){
 
-    /*get the highest valid bit of size */
-    int highest_bit = -1;
-    while(size){
-        size = size >> 1;
-        highest_bit++;
+    /* 空闲块至少为2*DSIZE，保证bit>=4，子区间的移位量非负 */
+    if(size < 2*DSIZE){
+        size = 2*DSIZE;
     }
 
-    if(highest_bit < 5){ 
-        return 0;
-    }else if(highest_bit >= 13 ){
-        return 9;
-    }else{
-        return (highest_bit-4);
+    int bit = 63 - __builtin_clzl(size); /* the highest valid bit of size */
+    int band = bit - (FIRST_BAND_BITS - 1);
+
+    if(band >= BANDNUM - 1){
+        return LISTNUM - 1;
+    }
+    if(band < 0){
+        return 0; /* 第一个区间中最高位不是FIRST_BAND_BITS-1的块都在第一个子区间 */
     }
+    return (band << SUBLIST_BITS) | (int)((size >> (bit - SUBLIST_BITS)) & (SUBNUM - 1));
 }
 
 
@@ -592,7 +3086,17 @@ static int insert_list(void * bp){
 
 
     size_t b_size = GET_SIZE(HDRP(bp));
-    int idx = list_idx(b_size); /* 对应链表的索引 ,idx范围[0,9] */
+    int idx = list_idx(b_size); /* 对应链表的索引 ,idx范围[0,LISTNUM-1] */
+
+    MARK_LIST(idx);
+    STAT(list_bytes[idx]) += b_size;
+    STAT(list_blocks[idx])++;
+
+    if(idx >= TREE_LIST){
+        tree_insert(seg_list + (idx * WSIZE), bp);
+        return 0;
+    }
+
     void * list_head = GET_PTR(seg_list + (idx * WSIZE)); /* 链表表头 */
 
 
@@ -611,10 +3115,13 @@ static int insert_list(void * bp){
         /* 寻找bp的后继，即大小不小于bp的第一个块 */
         void * tmp = list_head;
         void * following = NULL;
+        unsigned long steps = 0;
         while((tmp != NULL) && (GET_SIZE(HDRP(tmp)) < b_size)){
             following = tmp;
             tmp = SUCC(tmp);
+            steps++;
         }
+        LAT_SCAN(steps, MM_LAT_LONG_INSERT);
         
         /* 现在following指向bp的前驱，tmp指向bp的后继 */
 
@@ -654,6 +3161,20 @@ static int delete_list(void * bp){
     if(bp == NULL) return -1;
 
     int idx = list_idx((size_t)GET_SIZE(HDRP(bp))); /* idx为bp所在链表的索引 */
+
+    if(idx >= TREE_LIST){
+        if(GET_ALLOC(HDRP(bp)) || tree_delete(seg_list + (idx * WSIZE), bp) < 0){
+            printf("Deleting list error\n");
+            return -1;
+        }
+        if(GET_PTR(seg_list + (idx * WSIZE)) == NULL){
+            UNMARK_LIST(idx);
+        }
+        STAT(list_bytes[idx]) -= GET_SIZE(HDRP(bp));
+        STAT(list_blocks[idx])--;
+        return 0;
+    }
+
     void * list_head = GET_PTR(seg_list + (idx * WSIZE));   
   
     //printf("Starting to delete %lx with size %d at list %d\n",PTR_VALUE(bp),GET_SIZE(HDRP(bp)),idx);
@@ -663,6 +3184,8 @@ static int delete_list(void * bp){
         printf("Deleting list error\n");
         return -1;
     }     
+    STAT(list_bytes[idx]) -= GET_SIZE(HDRP(bp));
+    STAT(list_blocks[idx])--;
 
    
     if(bp == list_head){
@@ -670,6 +3193,7 @@ static int delete_list(void * bp){
         if(SUCC(bp) == NULL){
             /* 链表只有一个元素，则表头置空 */
             PUT_PTR((seg_list + (idx * WSIZE)),NULL);
+            UNMARK_LIST(idx);
         }else{
             /* 多于一个元素，则更新表头为bp的后继 */
             SET_PRED(SUCC(bp),NULL);
@@ -693,6 +3217,101 @@ static int delete_list(void * bp){
 
 
 
+/*
+ * tree_insert - Insert the free block bp into the treap whose root is stored at slot
+ * 
+ * 先沿键的方向下降到第一个优先级低于bp的结点，再把以该结点为根的子树
+ * 按bp的键拆分成两棵，分别作为bp的左右子树，全程无需递归和父指针。
+ */
+static void tree_insert(char *slot, void *bp){
+
+    void * t;
+
+    while(((t = GET_PTR(slot)) != NULL) && (PRIO(t) > PRIO(bp))){
+        slot = TREE_LESS(bp,t) ? LEFT_SLOT(t) : RIGHT_SLOT(t);
+    }
+
+    /* 将子树t拆分为小于bp的部分（挂在l上）和大于bp的部分（挂在r上） */
+    char * l = LEFT_SLOT(bp);
+    char * r = RIGHT_SLOT(bp);
+    while(t != NULL){
+        if(TREE_LESS(t,bp)){
+            PUT_PTR(l,t);
+            l = RIGHT_SLOT(t);
+            t = RIGHT(t);
+        }else{
+            PUT_PTR(r,t);
+            r = LEFT_SLOT(t);
+            t = LEFT(t);
+        }
+    }
+    PUT_PTR(l,NULL);
+    PUT_PTR(r,NULL);
+
+    PUT_PTR(slot,bp);
+}
+
+/*
+ * tree_delete - Remove the free block bp from the treap whose root is stored at slot
+ * 
+ * 找到bp后，将其左右子树按优先级合并，替换bp原来的位置
+ * success:return 0;bp not in the treap: return -1;
+ */
+static int tree_delete(char *slot, void *bp){
+
+    void * t;
+
+    while((t = GET_PTR(slot)) != bp){
+        if(t == NULL){
+            return -1;
+        }
+        slot = TREE_LESS(bp,t) ? LEFT_SLOT(t) : RIGHT_SLOT(t);
+    }
+
+    void * l = LEFT(bp);
+    void * r = RIGHT(bp);
+    while((l != NULL) && (r != NULL)){
+        if(PRIO(l) > PRIO(r)){
+            PUT_PTR(slot,l);
+            slot = RIGHT_SLOT(l);
+            l = RIGHT(l);
+        }else{
+            PUT_PTR(slot,r);
+            slot = LEFT_SLOT(r);
+            r = LEFT(r);
+        }
+    }
+    PUT_PTR(slot,(l != NULL) ? l : r);
+
+    SET_PRED(bp,NULL);
+    SET_SUCC(bp,NULL);
+    return 0;
+}
+
+/*
+ * tree_fit - Return the smallest block in the treap whose size is at least asize,
+ *            ties broken by address; NULL if there is none
+ */
+static void *tree_fit(char *slot, size_t asize){
+
+    void * t = GET_PTR(slot);
+    void * best = NULL;
+    unsigned long probes = 0;
+
+    while(t != NULL){
+        probes++;
+        if(GET_SIZE(HDRP(t)) >= asize){
+            best = t;
+            t = LEFT(t);
+        }else{
+            t = RIGHT(t);
+        }
+    }
+    STAT(fit_probes) += probes;
+    return best;
+}
+
+
 
 /*
  * Return whether the pointer is in the heap.
@@ -713,9 +3332,206 @@ static int aligned(const void *p) {
 
 
 /*
- * mm_checkheap
+ * check_tree - Check the subtree rooted at t of the treap for list idx,
+ *              every key in it should lie strictly between lo and hi (NULL for no bound)
+ * 
+ * success:return 0;error: return -1;
+ */
+static int check_tree(int lineno, int idx, void *t, void *lo, void *hi){
+
+    if(t == NULL){
+        return 0;
+    }
+
+    if(!in_heap(t)){
+        printf("%d:Tree node %lx not in the heap in list %d\n",lineno,PTR_VALUE(t),idx);
+        return -1;
+    }
+
+    if(GET_ALLOC(HDRP(t))){
+        printf("%d:An allocated block in the tree %d\n",lineno,idx);
+        return -1;
+    }
+
+    if(list_idx(GET_SIZE(HDRP(t))) != idx){
+        printf("%d:Block of size %u in the wrong tree %d\n",lineno,GET_SIZE(HDRP(t)),idx);
+        return -1;
+    }
+
+    /* 二叉搜索树的性质 */
+    if(((lo != NULL) && !TREE_LESS(lo,t)) || ((hi != NULL) && !TREE_LESS(t,hi))){
+        printf("%d:Tree order violated at %lx in list %d\n",lineno,PTR_VALUE(t),idx);
+        return -1;
+    }
+
+    /* 堆的性质 */
+    if(((LEFT(t) != NULL) && (PRIO(LEFT(t)) > PRIO(t))) || 
+        ((RIGHT(t) != NULL) && (PRIO(RIGHT(t)) > PRIO(t)))){
+        printf("%d:Tree priority violated at %lx in list %d\n",lineno,PTR_VALUE(t),idx);
+        return -1;
+    }
+
+    if(check_tree(lineno,idx,LEFT(t),lo,t) < 0){
+        return -1;
+    }
+    return check_tree(lineno,idx,RIGHT(t),t,hi);
+}
+
+
+/* 增量检查中报告块bp的错误 */
+#define CHECK_FAIL(bp, ...) do { \
+        printf("check: block %lx (offset %lu, header %08x): ", PTR_VALUE(bp), \
+               (unsigned long)((char *)HDRP(bp) - (char *)mem_heap_lo()), GET(HDRP(bp))); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        return -1; \
+    } while (0)
+
+/*
+ * check_block - Check the block bp, and its neighbours in the free list if it is free;
+ *               return 0 if it is consistent, else report it and return -1
+ *               调用者持有锁，线程安全的版本中seg_list指向bp所属arena的表头
+ */
+static int check_block(void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    int alloc = GET_ALLOC(HDRP(bp));
+
+    if (!aligned(bp))
+        CHECK_FAIL(bp, "payload not aligned to 8 bytes");
+    if (size < 2*DSIZE)
+        CHECK_FAIL(bp, "size %zu below the minimum block", size);
+    if (!in_heap((char *)bp + size - WSIZE))
+        CHECK_FAIL(bp, "size %zu runs past the end of the heap", size);
+    if ((GET_PREV_ALLOC(NEXT_BLKP(bp)) != 0) != (alloc != 0))
+        CHECK_FAIL(bp, "prev-alloc bit of the next block is %d", GET_PREV_ALLOC(NEXT_BLKP(bp)) != 0);
+
+    if (alloc) {
+        /* slab的run：空闲槽的计数与位图一致 */
+        if (IS_SLAB(bp) && (RUN_OF(bp) == (char *)bp)) {
+            unsigned int avail = 0;
+            if ((RUN_SLOT(bp) % DSIZE != 0) || (RUN_SLOT(bp) == 0) || (RUN_SLOT(bp) > SLAB_MAX))
+                CHECK_FAIL(bp, "run with slot size %u", RUN_SLOT(bp));
+            for (int w = 0; w < RUN_MAP_WORDS; ++w) {
+                avail += __builtin_popcountl(RUN_MAP(bp)[w]);
+            }
+            if ((avail != RUN_AVAIL(bp)) || (avail > RUN_SLOTS(RUN_SLOT(bp))))
+                CHECK_FAIL(bp, "run has %u free slots, %u recorded", avail, RUN_AVAIL(bp));
+        }
+        return 0;
+    }
+
+    /* 空闲块 */
+    int idx = list_idx(size);
+    if ((GET(HDRP(bp)) & ~0x2) != (GET(FTRP(bp)) & ~0x2))
+        CHECK_FAIL(bp, "footer %08x does not match", GET(FTRP(bp)));
+    if (!GET_PREV_ALLOC(bp))
+        CHECK_FAIL(bp, "previous block is also free");
+    if (!((LIST_MAP >> idx) & 1))
+        CHECK_FAIL(bp, "bitmap bit of list %d is clear", idx);
+
+    void *pred = PRED(bp);
+    void *succ = SUCC(bp);
+    if (((pred != NULL) && !in_heap(pred)) || ((succ != NULL) && !in_heap(succ)))
+        CHECK_FAIL(bp, "link %lx/%lx outside the heap in list %d", PTR_VALUE(pred), PTR_VALUE(succ), idx);
+    if (((pred != NULL) && (GET_ALLOC(HDRP(pred)) || (list_idx(GET_SIZE(HDRP(pred))) != idx))) ||
+        ((succ != NULL) && (GET_ALLOC(HDRP(succ)) || (list_idx(GET_SIZE(HDRP(succ))) != idx))))
+        CHECK_FAIL(bp, "linked to a block that is not free in list %d", idx);
+
+    if (idx >= TREE_LIST) {
+        /* treap：左孩子 < bp < 右孩子，孩子的优先级不高于bp */
+        if (((pred != NULL) && (!TREE_LESS(pred, bp) || (PRIO(pred) > PRIO(bp)))) ||
+            ((succ != NULL) && (!TREE_LESS(bp, succ) || (PRIO(succ) > PRIO(bp)))))
+            CHECK_FAIL(bp, "children %lx/%lx out of order in tree %d", PTR_VALUE(pred), PTR_VALUE(succ), idx);
+        return 0;
+    }
+
+    if ((pred == NULL) ? (GET_PTR(seg_list + idx * WSIZE) != bp) : (SUCC(pred) != bp))
+        CHECK_FAIL(bp, "not reachable from its predecessor %lx in list %d", PTR_VALUE(pred), idx);
+    if ((succ != NULL) && (PRED(succ) != bp))
+        CHECK_FAIL(bp, "successor %lx does not point back in list %d", PTR_VALUE(succ), idx);
+    if (((pred != NULL) && (GET_SIZE(HDRP(pred)) > size)) ||
+        ((succ != NULL) && (GET_SIZE(HDRP(succ)) < size)))
+        CHECK_FAIL(bp, "list %d not sorted by size here", idx);
+    return 0;
+}
+
+/*
+ * mm_check_step - Check the next budget blocks of the heap, continuing from where
+ *                 the last call stopped and wrapping around at the epilogue;
+ *                 return 0 if they are consistent, -1 after reporting the first error
+ */
+int mm_check_step(int budget) {
+    int ret = 0;
+
+#ifdef MM_THREADS
+    struct arena *a = cur_arena;
+    char *saved;
+
+    arena_get();
+    lock_all();
+    saved = seg_list;
+#endif
+    if (heap_listp != NULL) {
+        char *bp = __atomic_load_n(&check_cursor, __ATOMIC_RELAXED);
+        if (bp == NULL) {
+            bp = NEXT_BLKP(heap_listp);
+        }
+        for (; (budget > 0) && (ret == 0); --budget) {
+            if (GET_SIZE(HDRP(bp)) == 0) {
+                /* 结尾块：一轮结束，下一次从头开始 */
+                if (!GET_ALLOC(HDRP(bp)) || ((char *)bp != (char *)mem_heap_hi() + 1)) {
+                    printf("check: epilogue %lx (offset %lu) is not allocated or not at the end of the heap\n",
+                           PTR_VALUE(bp), (unsigned long)((char *)HDRP(bp) - (char *)mem_heap_lo()));
+                    ret = -1;
+                }
+                bp = NEXT_BLKP(heap_listp);
+                continue;
+            }
+#ifdef MM_THREADS
+            seg_list = ARENA_OF(bp)->heads;
+#endif
+            ret = check_block(bp);
+            bp = NEXT_BLKP(bp);
+        }
+        __atomic_store_n(&check_cursor, bp, __ATOMIC_RELAXED);
+    }
+#ifdef MM_THREADS
+    seg_list = saved;
+    unlock_all();
+    cur_arena = a;
+#endif
+    return ret;
+}
+
+/*
+ * check_tick - The automatic check of MM_CHECK_INTERVAL
+ */
+static void check_tick(void) {
+    check_countdown = __atomic_load_n(&check_interval, __ATOMIC_RELAXED);
+    mm_check_step((int)__atomic_load_n(&check_slice, __ATOMIC_RELAXED));
+}
+
+/*
+ * mm_checkheap - 线程安全的版本中持有所有arena的锁以及sbrk_lock进行检查
  */
 void mm_checkheap(int lineno) {
+#ifndef MM_THREADS
+    check_heap(lineno);
+#else
+    struct arena *a = cur_arena;
+
+    arena_get();
+    lock_all();
+    check_heap(lineno);
+    unlock_all();
+    cur_arena = a;
+#endif
+}
+
+/*
+ * check_heap - Check every block in the heap and every free list
+ */
+static void check_heap(int lineno) {
 
     /*check heap boundaries*/
     size_t upper_lim = 0x100000000;
@@ -739,6 +3555,9 @@ void mm_checkheap(int lineno) {
 
 
     int last_block_alloc = 1; //record the allocate bit of last block,initialized to 1
+    unsigned long blocks = 0;
+    size_t list_bytes[LISTNUM] = {0};
+    unsigned long list_blocks[LISTNUM] = {0};
     for(;GET_SIZE(HDRP(bp)) > 0;bp = NEXT_BLKP(bp)){
         /* check whether this block is in the heap */
         //printf("bp:%lx\n",PTR_VALUE(bp));
@@ -772,6 +3591,11 @@ void mm_checkheap(int lineno) {
         }
     
         last_block_alloc = GET_ALLOC(HDRP(bp)); 
+        blocks++;
+        if(!last_block_alloc){
+            list_bytes[list_idx(GET_SIZE(HDRP(bp)))] += GET_SIZE(HDRP(bp));
+            list_blocks[list_idx(GET_SIZE(HDRP(bp)))]++;
+        }
     }
     /*check epilogue block*/
     if(!GET_ALLOC(HDRP(bp))){
@@ -779,9 +3603,59 @@ void mm_checkheap(int lineno) {
         return;
     }    
 
+    /* mm_stats的计数器应与遍历的结果一致 */
+    struct counters c;
+    counters_sum(&c);
+    if(c.blocks != blocks){
+        printf("%d:Counters record %lu blocks, %lu in the heap\n",lineno,c.blocks,blocks);
+        return;
+    }
+    for(int i = 0;i < LISTNUM;++i){
+        if((c.list_bytes[i] != list_bytes[i]) || (c.list_blocks[i] != list_blocks[i])){
+            printf("%d:Counters record %lu blocks of %zu bytes in list %d, %lu of %zu in the heap\n",
+                   lineno,c.list_blocks[i],c.list_bytes[i],i,list_blocks[i],list_bytes[i]);
+            return;
+        }
+    }
+
+#ifndef MM_THREADS
+    check_lists(lineno);
+#else
+    /* 依次检查每个arena的链表 */
+    char *saved = seg_list;
+    for(int i = 0;i < MM_ARENAS;++i){
+        seg_list = arenas[i].heads;
+        cur_arena = &arenas[i]; /* mm_checkheap恢复cur_arena */
+        if(check_lists(lineno) < 0){
+            break;
+        }
+    }
+    seg_list = saved;
+#endif
+}
+
+/*
+ * check_lists - Check every free list under seg_list
+ * 
+ * success:return 0;error: return -1;
+ */
+static int check_lists(int lineno) {
+    void * bp;
 
     /*check the free block list*/
-    for(int i = 0;i < 10;++i){
+    for(int i = 0;i < LISTNUM;++i){
+        /* 位图与链表是否为空应当一致 */
+        if(((LIST_MAP >> i) & 1) != (GET_PTR(seg_list + i*WSIZE) != NULL)){
+            printf("%d:Bitmap bit %d does not match list %d\n",lineno,i,i);
+            return -1;
+        }
+        if(i >= TREE_LIST){
+            /* 大块链表为treap，单独检查 */
+            if(check_tree(lineno,i,GET_PTR(seg_list + i*WSIZE),NULL,NULL) < 0){
+                return -1;
+            }
+            continue;
+        }
         bp = GET_PTR(seg_list + i*WSIZE);
         void * pred = NULL;
         void * succ = NULL;
@@ -792,37 +3666,119 @@ void mm_checkheap(int lineno) {
 
             if(GET_ALLOC(HDRP(bp))){
                 printf("%d:An allocated block in the free list %d\n",lineno,i);
-                return;
+                return -1;
             }
 
             if(PTR_VALUE(bp) < PTR_VALUE(mem_heap_lo())){
                 printf("%d:Address lower than mem_heap_lo in list %d\n",lineno,i);
-                return;
+                return -1;
             }
 
             if(PTR_VALUE(bp) > PTR_VALUE(mem_heap_hi())){
                 printf("%d:Address higher than mem_heap_hi in list %d\n",lineno,i);
-                return;
+                return -1;
+            }
+
+#ifdef MM_THREADS
+            if(ARENA_OF(bp)->heads != seg_list){
+                printf("%d:Block %lx of another arena in list %d\n",lineno,PTR_VALUE(bp),i);
+                return -1;
             }
+#endif
 
 
             if(pred != NULL){
                 if((SUCC(pred) != bp) || (PRED(bp) != pred)){
                     printf("%d:previous pointer not consistent in list %d\n",lineno,i);
-                    return;
+                    return -1;
                 }
             }
             if(succ != NULL){
                 if((SUCC(bp) != succ) || (PRED(succ) != bp)){
                     printf("%d:next pointer not consistent in list %d\n",lineno,i);
-                    return;
+                    return -1;
                 }
             }
         }
     }
+
+    /*check the quick lists*/
+    size_t held = 0;
+    for(int c = 0;c < QUICK_NUM;++c){
+        unsigned int size = (c + 2) * DSIZE;
+        unsigned long count = 0;
+        for(bp = QUICK(head[c]);bp != NULL;bp = GET_PTR(bp),++count){
+            if(!in_heap(bp) || !aligned(bp)){
+                printf("%d:Block %lx outside the heap in quick list %d\n",lineno,PTR_VALUE(bp),c);
+                return -1;
+            }
+            if(!GET_ALLOC(HDRP(bp)) || IS_SLAB(bp) || (GET_SIZE(HDRP(bp)) < size)){
+                printf("%d:Block %lx of header %08x in quick list %d\n",lineno,PTR_VALUE(bp),GET(HDRP(bp)),c);
+                return -1;
+            }
+            held += size;
+            if(held > QUICK(bytes)){
+                break; /* 链表有环时也能结束 */
+            }
+        }
+        if((held <= QUICK(bytes)) && (count != QUICK(count[c]))){
+            printf("%d:Quick list %d holds %lu blocks, %lu recorded\n",lineno,c,count,QUICK(count[c]));
+            return -1;
+        }
+    }
+    if(held != QUICK(bytes)){
+        printf("%d:Quick lists hold %zu bytes, %zu recorded\n",lineno,held,QUICK(bytes));
+        return -1;
+    }
+
+    /*check the slab runs*/
+    for(int c = 0;c < SLAB_NUM;++c){
+        char * prev = NULL;
+        unsigned int slot = (c + 1) * DSIZE;
+        for(char * r = (char *)GET_PTR(SLAB_HEAD(c));r != NULL;prev = r,r = RUN_NEXT(r)){
+            unsigned int avail = 0;
+
+            if(!IS_SLAB(r) || (RUN_OF(r) != r) || !GET_ALLOC(HDRP(r)) || (GET_SIZE(HDRP(r)) < PAGE)){
+                printf("%d:Run %lx of slab %d is not a page-aligned allocated block\n",lineno,PTR_VALUE(r),c);
+                return -1;
+            }
+            if(RUN_SLOT(r) != slot){
+                printf("%d:Run %lx with slot size %u in slab %d\n",lineno,PTR_VALUE(r),RUN_SLOT(r),c);
+                return -1;
+            }
+            if(RUN_PREV(r) != prev){
+                printf("%d:previous pointer not consistent in slab %d\n",lineno,c);
+                return -1;
+            }
+            for(int w = 0;w < RUN_MAP_WORDS;++w){
+                avail += __builtin_popcountl(RUN_MAP(r)[w]);
+            }
+            if((avail != RUN_AVAIL(r)) || (avail == 0) || (avail > RUN_SLOTS(slot))){
+                printf("%d:Run %lx has %u free slots, %u recorded in slab %d\n",lineno,PTR_VALUE(r),avail,RUN_AVAIL(r),c);
+                return -1;
+            }
+#ifdef MM_THREADS
+            if(ARENA_OF(r)->heads != seg_list){
+                printf("%d:Run %lx of another arena in slab %d\n",lineno,PTR_VALUE(r),c);
+                return -1;
+            }
+#endif
+        }
+    }
+    return 0;
 }
 
 
+/* 用于debug，中序打印treap中的结点，cnt为已打印的结点个数 */
+static int print_tree(void *t, int cnt){
+    if(t == NULL){
+        return cnt;
+    }
+    cnt = print_tree(LEFT(t),cnt);
+    printf("Node %d: %lx size %u\n",cnt,PTR_VALUE(t),GET_SIZE(HDRP(t)));
+    return print_tree(RIGHT(t),cnt + 1);
+}
+
 /* 用于debug，打印索引为idx的链表的所有结点地址及其指向空闲块的大小 */
 void print_list(int idx){
     void * list_head = GET_PTR(seg_list + idx * WSIZE);
@@ -830,6 +3786,11 @@ void print_list(int idx){
         printf("The list is empty\n");
         return;
     }
+    if(idx >= TREE_LIST){
+        print_tree(list_head,0);
+        printf("Done\n");
+        return;
+    }
     void * tmp = list_head;
     int cnt = 0;
     for(;tmp != NULL;tmp = SUCC(tmp),cnt++){
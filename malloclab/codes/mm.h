@@ -0,0 +1,107 @@
+/*
+ * mm.h - Interface of the malloc packages.
+ */
+#include <stdio.h>
+
+extern int mm_init(void);
+extern void *mm_malloc(size_t size);
+extern void mm_free(void *ptr);
+extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+extern void mm_checkheap(int lineno);
+
+/*
+ * Extensions provided by mm.c only
+ */
+
+/* mm_mallopt的参数 */
+#define MM_MMAP_THRESHOLD  1   /* 不小于该值的请求使用mmap，0表示不使用 */
+#define MM_TRIM_THRESHOLD  2   /* 堆顶的空闲块不小于该值时释放其物理内存，0表示不释放 */
+#define MM_REALLOC_GROWTH  3   /* 再次扩大的块至少增长到原来的百分之几，不大于100表示关闭 */
+#define MM_LAT_SAMPLE      4   /* 每多少次调用计时一次，0表示不计时；仅在定义MM_LATENCY时有效 */
+#define MM_CHECK_INTERVAL  5   /* malloc、free、realloc每多少次调用自动做一次增量检查，0表示不检查 */
+#define MM_CHECK_SLICE     6   /* 每次自动检查的块数 */
+#define MM_CHUNK_SIZE      7   /* 堆不足时至少扩展的字节数 */
+#define MM_SPLIT_MIN       8   /* 分割空闲块时剩余部分的最小字节数，不足则整块分配 */
+#define MM_QUICK_LIMIT     9   /* 快速链表中的块超过该字节数时批量合并，0表示关闭延迟合并 */
+#define MM_CACHE_ALIGN    10   /* 不超过该字节数的请求独占整数个缓存行，0表示关闭 */
+#define MM_SLAB_LIMIT     11   /* 不超过该字节数（至多SLAB_MAX）的请求由slab分配，0表示关闭 */
+
+extern int mm_mallopt(int param, long value);
+extern int mm_trim(size_t pad);
+extern unsigned long mm_realloc_reserve_hits(void);
+extern int mm_size_rounding(size_t *from, size_t *to, int n);
+extern int mm_check_step(int budget);
+
+/* 一次分配n个size字节的块存入out，返回分配到的个数，其余的out[i]为NULL */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+/* 一次释放ptrs中的n个块（可以含NULL）。ptrs本身会被改写：函数按地址原地排序，返回后其中元素的顺序与调用前不同 */
+extern void mm_free_batch(void **ptrs, size_t n);
+/* 释放以size字节分配的块bp，不读取块的header */
+extern void mm_free_sized(void *ptr, size_t size);
+/* 有效载荷按alignment（2的幂）对齐的块 */
+extern void *mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *mm_aligned_alloc(size_t alignment, size_t size);
+
+/* mm_stats的结果 */
+#define MM_STATS_LISTS 64   /* 不小于任何配置下分离链表的个数（位图为64位） */
+#define MM_STATS_QUICK 127  /* 不小于任何配置下快速链表的个数（QUICK_MAX不超过1024） */
+struct mm_stats {
+    size_t heap_size;                   /* 堆的大小 */
+    size_t in_use;                      /* 已分配块的字节数，包括header、slab的run以及线程缓存中的块 */
+    size_t free_bytes;                  /* 空闲块的字节数 */
+    size_t mmapped;                     /* 映射的块的总长度，不属于堆 */
+    unsigned long alloc_blocks;         /* 已分配块的个数 */
+    unsigned long free_blocks;          /* 空闲块的个数 */
+    int lists;                          /* 分离链表的个数 */
+    size_t list_bytes[MM_STATS_LISTS];  /* 每个链表中空闲块的字节数 */
+    unsigned long list_blocks[MM_STATS_LISTS]; /* 每个链表中空闲块的个数 */
+    unsigned long extend_heap;          /* extend_heap的次数 */
+    unsigned long coalesce[4];          /* coalesce四种情况各自的次数 */
+    unsigned long fit_searches;         /* find_fit的次数 */
+    unsigned long fit_probes;           /* find_fit查看的空闲块数，除以fit_searches即平均探查长度 */
+    unsigned long realloc_inplace;      /* 原地完成的realloc */
+    unsigned long realloc_copy;         /* 需要复制的realloc */
+    unsigned long reserve_hits;         /* 同mm_realloc_reserve_hits() */
+    size_t deferred_bytes;              /* 快速链表中等待合并的块的字节数，按所在的类计，不计入in_use */
+    unsigned long deferred_blocks;      /* 快速链表中的块数，不计入alloc_blocks */
+    int quick_lists;                    /* 快速链表的个数 */
+    unsigned long quick_blocks[MM_STATS_QUICK]; /* 第c个快速链表（块大小(c+2)*8）中的块数 */
+};
+extern int mm_stats(struct mm_stats *st);
+
+/* mm_latency的结果 */
+#define MM_LAT_MALLOC       0   /* 操作 */
+#define MM_LAT_FREE         1
+#define MM_LAT_REALLOC      2
+#define MM_LAT_CALLOC       3
+#define MM_LAT_OPS          4
+#define MM_LAT_EXTEND       0   /* 慢路径：extend_heap */
+#define MM_LAT_LONG_FIT     1   /* 慢路径：find_fit查看了很多块 */
+#define MM_LAT_LONG_INSERT  2   /* 慢路径：insert_list查看了很多块 */
+#define MM_LAT_TAGS         3
+#define MM_LAT_BUCKETS      64
+struct mm_latency {
+    unsigned long op[MM_LAT_OPS][MM_LAT_BUCKETS];   /* 第b格：耗时位于[2^b,2^(b+1))个周期的调用数 */
+    unsigned long tag[MM_LAT_TAGS][MM_LAT_BUCKETS]; /* 经过该慢路径的调用的耗时 */
+};
+extern int mm_latency(struct mm_latency *lat);
+extern void mm_latency_reset(void);
+
+/* mm_snapshot的格式 */
+#define MM_SNAP_JSON    0
+#define MM_SNAP_BINARY  1
+/* 块的标志 */
+#define MM_SNAP_ALLOC   0x1     /* 已分配 */
+#define MM_SNAP_SLAB    0x2     /* slab的run */
+#define MM_SNAP_ZERO    0x4     /* 已知为0的空闲块 */
+#define MM_SNAP_DEFERRED 0x8    /* 已分配状态，但在快速链表中等待合并 */
+/*
+ * 二进制格式，整数均为小端序：
+ *   8字节魔数"MMSNAP01"，u32块数，u32链表个数，u64堆的大小，
+ *   之后每块12字节：u32 header相对堆起点的偏移，u32块的大小，u8标志，
+ *   u8所在的链表（已分配块为255），u16所属的arena
+ */
+extern int mm_snapshot(FILE *fp, int format);
+extern void mm_fragmentation(FILE *fp);
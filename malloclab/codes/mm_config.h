@@ -0,0 +1,151 @@
+/*
+ * mm_config.h - The tunable policy of mm.c.
+ *
+ * 每一项都可以在编译时用-D覆盖，例如
+ *     make MMFLAGS="-DCHUNKSIZE=16384 -DSUBLIST_BITS=1"
+ * 只影响mm.c；mm-*.c是早先的版本，保留各自的取值。
+ *
+ * 不改变堆的布局的几项还可以在运行时修改：mm_init读取下表中的环境变量，
+ * 效果与用同样的值调用mm_mallopt相同，非法的值被忽略。mm_init之后调用mm_mallopt仍可再修改。
+ *
+ *     环境变量             mm_mallopt参数       初值
+ *     MM_CHUNK_SIZE        MM_CHUNK_SIZE        CHUNKSIZE
+ *     MM_SPLIT_MIN         MM_SPLIT_MIN         SPLIT_MIN
+ *     MM_MMAP_THRESHOLD    MM_MMAP_THRESHOLD    MMAP_THRESHOLD
+ *     MM_TRIM_THRESHOLD    MM_TRIM_THRESHOLD    TRIM_THRESHOLD
+ *     MM_REALLOC_GROWTH    MM_REALLOC_GROWTH    REALLOC_GROWTH
+ *     MM_CHECK_INTERVAL    MM_CHECK_INTERVAL    0
+ *     MM_CHECK_SLICE       MM_CHECK_SLICE       CHECK_SLICE
+ *     MM_LAT_SAMPLE        MM_LAT_SAMPLE        LAT_SAMPLE
+ *     MM_QUICK_LIMIT       MM_QUICK_LIMIT       QUICK_LIMIT
+ *     MM_CACHE_ALIGN       MM_CACHE_ALIGN       CACHE_ALIGN
+ *     MM_SLAB_LIMIT        MM_SLAB_LIMIT        SLAB_LIMIT
+ */
+#ifndef MM_CONFIG_H
+#define MM_CONFIG_H
+
+/* 堆不足时至少扩展的字节数，chunk_size的初值 */
+#ifndef CHUNKSIZE
+#define CHUNKSIZE       (1<<12)
+#endif
+
+/* 分割空闲块时剩余部分的最小字节数，不足则整块分配，split_min的初值；至少为最小块2*DSIZE */
+#ifndef SPLIT_MIN
+#define SPLIT_MIN       16
+#endif
+
+/* 分离链表的划分：第一个区间为[1,2^FIRST_BAND_BITS)，之后每个区间是前一个的2倍，共BANDNUM个，最后一个无上界 */
+#ifndef FIRST_BAND_BITS
+#define FIRST_BAND_BITS 5
+#endif
+#ifndef BANDNUM
+#define BANDNUM         10
+#endif
+/* 每个2的幂区间等分成的子区间个数的对数，可以为0、1、2 */
+#ifndef SUBLIST_BITS
+#define SUBLIST_BITS    0
+#endif
+
+/* slab的槽的最大字节数，为8的倍数 */
+#ifndef SLAB_MAX
+#define SLAB_MAX        56
+#endif
+/* 不超过该字节数的请求由slab分配，slab_limit的初值，0表示关闭 */
+#ifndef SLAB_LIMIT
+#ifdef DRIVER
+#define SLAB_LIMIT      0                   /* 每一类至少占用一页，驱动程序的小trace上利用率下降 */
+#else
+#define SLAB_LIMIT      SLAB_MAX
+#endif
+#endif
+
+/* 延迟合并：不超过QUICK_MAX字节的块释放时放入快速链表，为8的倍数 */
+#ifndef QUICK_MAX
+#define QUICK_MAX       256
+#endif
+/* 快速链表中的块超过该字节数时批量合并，quick_limit的初值，0表示关闭延迟合并 */
+#ifndef QUICK_LIMIT
+#ifdef DRIVER
+#define QUICK_LIMIT     0                   /* 驱动程序以利用率评分，延迟合并会降低利用率 */
+#else
+#define QUICK_LIMIT     (64 * 1024)
+#endif
+#endif
+
+/* 缓存行的字节数，为2的幂 */
+#ifndef CACHE_LINE
+#define CACHE_LINE      64
+#endif
+/* 不超过该字节数的请求独占整数个缓存行，cache_align的初值，0表示关闭 */
+#ifndef CACHE_ALIGN
+#define CACHE_ALIGN     0
+#endif
+
+/* 不小于该字节数的请求直接mmap，mmap_threshold的初值 */
+#ifndef MMAP_THRESHOLD
+#ifdef DRIVER
+#define MMAP_THRESHOLD  0                   /* 驱动程序要求有效载荷位于堆中 */
+#else
+#define MMAP_THRESHOLD  (256 * 1024)
+#endif
+#endif
+
+/* 堆顶的空闲块不小于该字节数时归还给系统，trim_threshold的初值，0表示不自动归还 */
+#ifndef TRIM_THRESHOLD
+#ifdef DRIVER
+#define TRIM_THRESHOLD  0                   /* 阶段性的trace反复madvise后再缺页，吞吐量降到约三分之一 */
+#else
+#define TRIM_THRESHOLD  (128 * 1024)
+#endif
+#endif
+
+/* realloc的几何增长，realloc_growth的初值，默认关闭 */
+#ifndef REALLOC_GROWTH
+#define REALLOC_GROWTH  0
+#endif
+
+/* 每次自动检查的块数，check_slice的初值 */
+#ifndef CHECK_SLICE
+#define CHECK_SLICE     16
+#endif
+
+/* 每LAT_SAMPLE次调用计时一次，lat_sample的初值 */
+#ifndef LAT_SAMPLE
+#define LAT_SAMPLE      64
+#endif
+
+/* 线程安全的版本中arena的个数 */
+#ifndef MM_ARENAS
+#define MM_ARENAS       4
+#endif
+
+
+#if SUBLIST_BITS < 0 || SUBLIST_BITS > 2
+#error "SUBLIST_BITS must be 0, 1 or 2"
+#endif
+#if FIRST_BAND_BITS < 4
+#error "FIRST_BAND_BITS must be at least 4, the minimum block is 16 bytes"
+#endif
+#if BANDNUM < 3 || (BANDNUM - 1) * (1 << SUBLIST_BITS) + 1 > 64
+#error "BANDNUM must be at least 3, and there can be at most 64 free lists"
+#endif
+#if SPLIT_MIN < 16 || SPLIT_MIN % 8 != 0
+#error "SPLIT_MIN must be a multiple of 8, at least 16"
+#endif
+#if SLAB_MAX < 8 || SLAB_MAX > 56 || SLAB_MAX % 8 != 0
+#error "SLAB_MAX must be a multiple of 8 from 8 to 56"
+#endif
+#if SLAB_LIMIT < 0 || SLAB_LIMIT > SLAB_MAX
+#error "SLAB_LIMIT must be from 0 to SLAB_MAX"
+#endif
+#if QUICK_MAX < 16 || QUICK_MAX > 1024 || QUICK_MAX % 8 != 0
+#error "QUICK_MAX must be a multiple of 8 from 16 to 1024"
+#endif
+#if CACHE_LINE < 16 || CACHE_LINE > 4096 || (CACHE_LINE & (CACHE_LINE - 1)) != 0
+#error "CACHE_LINE must be a power of 2 from 16 to 4096"
+#endif
+#if CACHE_ALIGN < 0 || CACHE_ALIGN > 4096
+#error "CACHE_ALIGN must be from 0 to 4096"
+#endif
+
+#endif /* MM_CONFIG_H */
@@ -0,0 +1,492 @@
+/*
+ * smoke.c - Threaded smoke test of mm.c.
+ *
+ * The Makefile links this file with mm.c compiled with -DMM_THREADS, and
+ * again with -DMM_THREADS -DMM_LATENCY, so that the code behind those
+ * flags is built and run by make test.  The public symbols are not renamed.
+ * It is also linked with the single-threaded mm.c, and then runs one
+ * worker at a time, and with mm.c compiled with -DMM_THREADS
+ * -DMM_SIZED_CHECK, so that every mm_free_sized checks the size it is given.
+ *
+ * THREADS workers run at once, ROUNDS times over, each doing random
+ * mallocs, frees, reallocs and callocs on its own slots.  A tenth of the
+ * blocks come from mm_memalign, mm_posix_memalign or mm_aligned_alloc with
+ * an alignment of 8 to 4096 bytes, which is checked; they are freed and
+ * reallocated like the others.  Every payload is filled with a tag and
+ * checked before it is freed or reallocated.  A
+ * quarter of the frees go through a shared mailbox instead, so that blocks
+ * are freed by other threads than the one that allocated them, and a
+ * third through mm_free_sized with the size last asked for.  Now and
+ * then a worker also takes a batch of blocks with mm_malloc_batch and
+ * gives it back with mm_free_batch.  One worker calls mm_checkheap now and
+ * then while the others keep running; as in bench, stdout is captured
+ * meanwhile and mm_checkheap, like the size checks, must stay silent.
+ * It also reads mm_stats then, and again at the end: the free lists must
+ * add up to the free bytes, and what is in use, free or deferred must fill
+ * the heap but for its prefix.  At the end, with no worker left to extend
+ * the heap, its size must be memlib's, and nothing may be left mapped.
+ *
+ * The incremental checker runs throughout: every STEP_EVERY calls of a
+ * thread, malloc, free and realloc check the next STEP blocks from the
+ * cursor (MM_CHECK_INTERVAL), so the cursor keeps landing on blocks that
+ * are then coalesced away or that sit at the top when the heap grows.
+ * Every CHECK operations each worker also calls mm_check_step itself, and
+ * main walks one full lap from the cursor at the end; any error fails.
+ *
+ * Between rounds, while no worker runs, the heap is written out with
+ * mm_snapshot in both formats and with mm_fragmentation.  Both snapshots
+ * are parsed back: they must list the same blocks, the blocks must tile
+ * the heap up to the epilogue, and their totals must match mm_stats and
+ * the summaries in the JSON and in mm_fragmentation.
+ *
+ * Last, main leaves HOLES dirty free blocks of HOLE bytes between small
+ * live ones, with the automatic trim off, and calls mm_trim: it must
+ * report a release, and mincore must find that many fewer pages of the
+ * heap resident.
+ *
+ * usage: smoke [operations per worker]
+ *
+ * The exit status is 1 if a check failed, else 0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#ifdef MM_THREADS
+#define THREADS  8
+#else
+#define THREADS  1
+#endif
+#define ROUNDS   3
+#define SLOTS    512     /* live blocks per worker */
+#define MAILBOX  64      /* blocks in flight between workers */
+#define CHECK    4000    /* worker 0 checks the heap every CHECK operations */
+#define BATCH    48      /* at most BATCH blocks in a batch */
+#define BATCHES  200     /* a worker takes a batch every BATCHES operations */
+#define STEP_EVERY 16    /* the allocator checks STEP blocks every STEP_EVERY calls of a thread */
+#define STEP     8
+#define HOLES    16      /* free blocks left for mm_trim */
+#define HOLE     65536
+
+static void *mailbox[MAILBOX];
+static long ops = 50000;
+
+/* xorshift, one state per worker */
+static unsigned long next_rand(unsigned long *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static void fail(const char *msg) {
+    fprintf(stderr, "smoke: %s\n", msg);
+    exit(1);
+}
+
+/* a request size: mostly small, some medium, a few large */
+static size_t pick_size(unsigned long *s) {
+    unsigned long k = next_rand(s) % 100;
+
+    if (k < 70)
+        return 1 + next_rand(s) % 120;
+    if (k < 95)
+        return 1 + next_rand(s) % 2000;
+    return 1 + next_rand(s) % 40000;
+}
+
+/*
+ * mm_stats, and whether its figures add up: the free lists to the free
+ * bytes and blocks, the quick lists to the deferred blocks, and the bytes
+ * in use, free or deferred to the heap less the prefix, the prologue and
+ * the epilogue, which take well under a page
+ */
+static void check_stats(struct mm_stats *st) {
+    size_t bytes = 0;
+    unsigned long blocks = 0, quick = 0;
+
+    if (mm_stats(st) != 0)
+        fail("mm_stats failed");
+    for (int k = 0; k < st->lists; ++k) {
+        bytes += st->list_bytes[k];
+        blocks += st->list_blocks[k];
+    }
+    if ((bytes != st->free_bytes) || (blocks != st->free_blocks))
+        fail("mm_stats: the free lists do not add up to the free bytes");
+    for (int c = 0; c < st->quick_lists; ++c)
+        quick += st->quick_blocks[c];
+    if (quick != st->deferred_blocks)
+        fail("mm_stats: the quick lists do not add up to the deferred blocks");
+    bytes = st->in_use + st->free_bytes + st->deferred_bytes;
+    if ((bytes >= st->heap_size) || (st->heap_size - bytes >= 4096))
+        fail("mm_stats: the bytes do not add up to the heap size");
+}
+
+/* the whole of fp, NUL-terminated, in memory from the libc malloc */
+static char *slurp(FILE *fp, size_t *len) {
+    char *buf;
+
+    fflush(fp);
+    if ((fseek(fp, 0, SEEK_END) != 0) || ((long)(*len = ftell(fp)) < 0))
+        fail("cannot read a snapshot back");
+    rewind(fp);
+    if (((buf = malloc(*len + 1)) == NULL) || (fread(buf, 1, *len, fp) != *len))
+        fail("cannot read a snapshot back");
+    buf[*len] = '\0';
+    return buf;
+}
+
+/* the number after "key": in the JSON text p */
+static unsigned long json_num(const char *p, const char *key) {
+    char pat[64];
+    const char *q;
+
+    snprintf(pat, sizeof(pat), "\"%s\":", key);
+    if ((q = strstr(p, pat)) == NULL)
+        fail("snapshot: a JSON field is missing");
+    return strtoul(q + strlen(pat), NULL, 10);
+}
+
+static unsigned long get_le(const unsigned char *p, int n) {
+    unsigned long v = 0;
+
+    for (int i = n - 1; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/*
+ * mm_snapshot in both formats and mm_fragmentation, with no worker
+ * running: the binary blocks must tile the heap and add up to st, and the
+ * JSON must list the same blocks under a summary with the same totals
+ */
+static void check_snapshot(const struct mm_stats *st) {
+    FILE *fp = tmpfile();
+    unsigned long list_blocks[MM_STATS_LISTS] = {0};
+    unsigned long blocks, alloc = 0, free_blocks = 0, deferred = 0;
+    size_t in_use = 0, free_bytes = 0, deferred_bytes = 0, end, len, jlen;
+    size_t f_heap, f_in_use, f_free;
+    unsigned long f_blocks, f_free_blocks;
+    unsigned char *bin, *rec;
+    char *json, *p;
+
+    if (fp == NULL)
+        fail("cannot open a file for the snapshots");
+    if (mm_snapshot(fp, MM_SNAP_BINARY) != 0)
+        fail("mm_snapshot failed");
+    bin = (unsigned char *)slurp(fp, &len);
+    blocks = get_le(bin + 8, 4);
+    if ((len < 24) || (memcmp(bin, "MMSNAP01", 8) != 0) || (len != 24 + 12 * blocks) ||
+        ((int)get_le(bin + 12, 4) != st->lists) || (get_le(bin + 16, 8) != st->heap_size))
+        fail("snapshot: bad binary header");
+
+    end = get_le(bin + 24, 4);
+    for (rec = bin + 24; rec < bin + len; rec += 12) {
+        size_t size = get_le(rec + 4, 4);
+        int flags = rec[8], list = rec[9];
+
+        if (get_le(rec, 4) != end)
+            fail("snapshot: the blocks do not tile the heap");
+        end += size;
+        if (!(flags & MM_SNAP_ALLOC)) {
+            if (list >= st->lists)
+                fail("snapshot: a free block is in no list");
+            list_blocks[list]++;
+            free_blocks++;
+            free_bytes += size;
+        } else if (list != 255) {
+            fail("snapshot: an allocated block is in a list");
+        } else if (flags & MM_SNAP_DEFERRED) {
+            deferred++;
+            deferred_bytes += size;
+        } else {
+            alloc++;
+            in_use += size;
+        }
+    }
+    if (end + 4 != st->heap_size)
+        fail("snapshot: the blocks do not reach the epilogue");
+    /* mm_stats counts a deferred block at the size of its quick list, less after mm_free_sized */
+    if ((alloc != st->alloc_blocks) || (in_use + deferred_bytes != st->in_use + st->deferred_bytes) ||
+        (free_blocks != st->free_blocks) || (free_bytes != st->free_bytes) ||
+        (deferred != st->deferred_blocks) || (deferred_bytes < st->deferred_bytes))
+        fail("snapshot: the blocks do not add up to mm_stats");
+    for (int k = 0; k < st->lists; ++k) {
+        if (list_blocks[k] != st->list_blocks[k])
+            fail("snapshot: the blocks of a list do not match mm_stats");
+    }
+
+    rewind(fp);
+    if ((ftruncate(fileno(fp), 0) != 0) || (mm_snapshot(fp, MM_SNAP_JSON) != 0))
+        fail("mm_snapshot failed");
+    json = slurp(fp, &jlen);
+    if ((strncmp(json, "{\"version\":2,", 13) != 0) ||
+        (json_num(json, "heap_size") != st->heap_size) || (json_num(json, "blocks") != blocks) ||
+        (json_num(json, "in_use") != in_use) || (json_num(json, "free_bytes") != free_bytes) ||
+        (json_num(json, "free_blocks") != free_blocks) ||
+        (json_num(json, "deferred_bytes") != deferred_bytes))
+        fail("snapshot: the JSON summary does not match the blocks");
+    if ((p = strstr(json, "\n\"blocks\":[")) == NULL)
+        fail("snapshot: the JSON has no blocks");
+    p += 11;
+    for (rec = bin + 24; rec < bin + len; rec += 12) {
+        unsigned long off, size;
+        int flags, list, arena, n;
+
+        if (rec > bin + 24) {
+            p += (*p == ',') ? 1 : 0;
+            p += (*p == '\n') ? 1 : 0;
+        }
+        if ((sscanf(p, "[%lu,%lu,%d,%d,%d]%n", &off, &size, &flags, &list, &arena, &n) != 5) ||
+            (off != get_le(rec, 4)) || (size != get_le(rec + 4, 4)) || (flags != rec[8]) ||
+            (list != ((rec[9] == 255) ? -1 : rec[9])) || (arena != (int)get_le(rec + 10, 2)))
+            fail("snapshot: the JSON and binary blocks differ");
+        p += n;
+    }
+    if (strcmp(p, "]}\n") != 0)
+        fail("snapshot: the JSON does not end after the blocks");
+
+    rewind(fp);
+    if (ftruncate(fileno(fp), 0) != 0)
+        fail("cannot open a file for the snapshots");
+    mm_fragmentation(fp);
+    rewind(fp);
+    if ((fscanf(fp, "heap %zu bytes in %lu blocks: %zu in use, %zu free in %lu blocks",
+                &f_heap, &f_blocks, &f_in_use, &f_free, &f_free_blocks) != 5) ||
+        (f_heap != st->heap_size) || (f_blocks != blocks) || (f_in_use != in_use) ||
+        (f_free != free_bytes) || (f_free_blocks != free_blocks))
+        fail("mm_fragmentation does not match the snapshot");
+    free(bin);
+    free(json);
+    fclose(fp);
+}
+
+/* the pages of the heap that are resident */
+static size_t resident(void) {
+    size_t page = mem_pagesize();
+    size_t pages = (mem_heapsize() + page - 1) / page, n = 0;
+    unsigned char *vec = malloc(pages);
+
+    if ((vec == NULL) || (mincore(mem_heap_lo(), pages * page, vec) != 0))
+        fail("mincore failed");
+    for (size_t i = 0; i < pages; ++i)
+        n += vec[i] & 1;
+    free(vec);
+    return n;
+}
+
+/*
+ * HOLES written free blocks of HOLE bytes, mostly kept apart by small live
+ * ones: mm_trim must release all of their pages but the first and the last
+ * of each, and more if some coalesced
+ */
+static void check_trim(void) {
+    void *hole[HOLES], *sep[HOLES];
+    size_t before;
+
+    /* in the heap, and not released by free if they end up at the top */
+    if (!mm_mallopt(MM_MMAP_THRESHOLD, 0) || !mm_mallopt(MM_TRIM_THRESHOLD, 0))
+        fail("mm_mallopt refused the thresholds");
+    for (int i = 0; i < HOLES; ++i) {
+        if (((hole[i] = mm_malloc(HOLE)) == NULL) || ((sep[i] = mm_malloc(64)) == NULL))
+            fail("malloc failed");
+        memset(hole[i], 0x5a, HOLE);
+    }
+    for (int i = 0; i < HOLES; ++i)
+        mm_free(hole[i]);
+    before = resident();
+    if (mm_trim(0) != 1)
+        fail("mm_trim released nothing");
+    if (resident() + HOLES * (HOLE / mem_pagesize() - 2) > before)
+        fail("mm_trim left the free pages resident");
+    for (int i = 0; i < HOLES; ++i)
+        mm_free(sep[i]);
+}
+
+static void verify(const unsigned char *p, size_t n, unsigned char tag, const char *msg) {
+    for (size_t i = 0; i < n; ++i) {
+        if (p[i] != tag)
+            fail(msg);
+    }
+}
+
+/*
+ * A batch of blocks of one size, each filled with its own tag so that
+ * overlapping blocks are caught.  Every other batch is shuffled and has
+ * one block freed on its own before mm_free_batch, whose slot is NULL.
+ */
+static void batch(unsigned long *s) {
+    void *out[BATCH];
+    size_t size = pick_size(s);
+    size_t n = 1 + next_rand(s) % BATCH;
+    unsigned char tag = (unsigned char)next_rand(s);
+
+    if (mm_malloc_batch(size, n, out) != n)
+        fail("malloc_batch failed");
+    for (size_t i = 0; i < n; ++i)
+        memset(out[i], (unsigned char)(tag + i), size);
+    for (size_t i = 0; i < n; ++i)
+        verify(out[i], size, (unsigned char)(tag + i), "malloc_batch blocks overlap");
+
+    if (next_rand(s) & 1) {
+        for (size_t i = n - 1; i > 0; --i) {
+            size_t j = next_rand(s) % (i + 1);
+            void *t = out[i];
+
+            out[i] = out[j];
+            out[j] = t;
+        }
+        mm_free(out[0]);
+        out[0] = NULL;
+    }
+    mm_free_batch(out, n);
+}
+
+static void *worker(void *arg) {
+    unsigned long s = 1234567 + (uintptr_t)arg * 7919;
+    int id = (int)((uintptr_t)arg % THREADS);
+    unsigned char *p[SLOTS] = {0};
+    size_t size[SLOTS];
+    unsigned char tag[SLOTS];
+    struct mm_stats st;
+
+    for (long op = 0; op < ops; ++op) {
+        int i = next_rand(&s) % SLOTS;
+        unsigned long r = next_rand(&s) % 20;
+
+        if ((id == 0) && (op % CHECK == 0)) {
+            mm_checkheap(__LINE__);
+            check_stats(&st);
+        }
+        if (op % BATCHES == BATCHES - 1)
+            batch(&s);
+        if ((op % CHECK == CHECK / 2) && (mm_check_step(STEP) != 0))
+            fail("mm_check_step found an error");
+
+        if (p[i] == NULL) {
+            size[i] = pick_size(&s);
+            tag[i] = (unsigned char)next_rand(&s);
+            if (r < 4) {
+                if ((p[i] = mm_calloc(1, size[i])) == NULL)
+                    fail("calloc failed");
+                verify(p[i], size[i], 0, "calloc did not zero the block");
+            } else if (r < 6) {
+                size_t align = (size_t)8 << (next_rand(&s) % 10);
+
+                if (r == 4)
+                    p[i] = mm_memalign(align, size[i]);
+                else if (next_rand(&s) & 1)
+                    p[i] = mm_aligned_alloc(align, size[i]);
+                else if (mm_posix_memalign((void **)&p[i], align, size[i]) != 0)
+                    p[i] = NULL;
+                if (p[i] == NULL)
+                    fail("memalign failed");
+                if ((uintptr_t)p[i] & (align - 1))
+                    fail("memalign returned a misaligned block");
+            } else if ((p[i] = mm_malloc(size[i])) == NULL) {
+                fail("malloc failed");
+            }
+            memset(p[i], tag[i], size[i]);
+            continue;
+        }
+
+        verify(p[i], size[i], tag[i], "payload changed while allocated");
+        if (r < 5) {
+            mm_free(p[i]);
+        } else if (r < 9) {
+            mm_free_sized(p[i], size[i]);
+        } else if (r < 12) {
+            void *old = __atomic_exchange_n(&mailbox[next_rand(&s) % MAILBOX], p[i], __ATOMIC_ACQ_REL);
+            mm_free(old);
+        } else {
+            size_t n = 1 + next_rand(&s) % (2 * size[i] + 16);
+            unsigned char *q = mm_realloc(p[i], n);
+
+            if (q == NULL)
+                fail("realloc failed");
+            verify(q, (n < size[i]) ? n : size[i], tag[i], "realloc lost the payload");
+            memset(q, tag[i], n);
+            p[i] = q;
+            size[i] = n;
+            continue;
+        }
+        p[i] = NULL;
+    }
+    for (int i = 0; i < SLOTS; ++i)
+        mm_free(p[i]);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    pthread_t th[THREADS];
+    struct mm_stats st;
+    FILE *log = tmpfile();
+    int saved = dup(STDOUT_FILENO);
+
+    if (argc > 1)
+        ops = atol(argv[1]);
+    if ((log == NULL) || (saved < 0))
+        fail("cannot capture stdout");
+
+    fflush(stdout);
+    dup2(fileno(log), STDOUT_FILENO);
+    mem_init();
+    if (mm_init() < 0)
+        fail("mm_init failed");
+    if (!mm_mallopt(MM_CHECK_INTERVAL, STEP_EVERY) || !mm_mallopt(MM_CHECK_SLICE, STEP))
+        fail("mm_mallopt refused the check interval");
+
+    for (int r = 0; r < ROUNDS; ++r) {
+        for (int t = 0; t < THREADS; ++t)
+            pthread_create(&th[t], NULL, worker, (void *)(uintptr_t)(r * THREADS + t));
+        for (int t = 0; t < THREADS; ++t)
+            pthread_join(th[t], NULL);
+        check_stats(&st);
+        check_snapshot(&st);
+    }
+    for (int i = 0; i < MAILBOX; ++i)
+        mm_free(mailbox[i]);
+    mm_checkheap(__LINE__);
+    check_stats(&st);
+    if (st.heap_size != mem_heapsize())
+        fail("mm_stats: the heap size is not memlib's");
+    if (st.mmapped != 0)
+        fail("mm_stats: blocks are still mapped after every free");
+    /* one lap from wherever the cursor stopped back to it, the epilogue included */
+    if (mm_check_step((int)(st.alloc_blocks + st.free_blocks + st.deferred_blocks + 1)) != 0)
+        fail("mm_check_step found an error");
+    if ((st.extend_heap == 0) || (st.fit_searches == 0) ||
+        (st.coalesce[1] + st.coalesce[2] + st.coalesce[3] == 0) ||
+        (st.realloc_inplace == 0) || (st.realloc_copy == 0))
+        fail("mm_stats: a hot-path counter never moved");
+    check_trim();
+    mm_checkheap(__LINE__);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    if (lseek(fileno(log), 0, SEEK_END) != 0)
+        fail("mm_checkheap, the automatic checks or mm_free_sized reported errors");
+
+#ifdef MM_LATENCY
+    /* the calls are sampled at the default interval, so some mallocs were timed */
+    struct mm_latency lat;
+    unsigned long timed = 0;
+
+    if (mm_latency(&lat) != 0)
+        fail("mm_latency failed");
+    for (int b = 0; b < MM_LAT_BUCKETS; ++b)
+        timed += lat.op[MM_LAT_MALLOC][b];
+    if (timed == 0)
+        fail("no malloc was timed");
+#endif
+
+    printf("smoke: %d threads x %ld operations ok, heap %zu bytes\n",
+           THREADS, ops * ROUNDS, mem_heapsize());
+    return 0;
+}